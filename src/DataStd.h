@@ -91,7 +91,10 @@ public:
             scaleX.resize(p);
     }
 
-    void standardize(MatrixXd &X, Vector &Y, Vector &wts)
+    // standardize a response as standardize() does. meanY 
+    // and scaleY are overwritten, so with several responses 
+    // each is standardized on its own copy of this object
+    void standardize_y(Vector &Y, Vector &wts)
     {
         double n_invsqrt = 1.0 / std::sqrt(Double(n));
         int wt_len = wts.size();
@@ -139,6 +142,14 @@ public:
             default:
                 break;
         }
+    }
+
+    void standardize(MatrixXd &X, Vector &Y, Vector &wts)
+    {
+        double n_invsqrt = 1.0 / std::sqrt(Double(n));
+        int wt_len = wts.size();
+
+        standardize_y(Y, wts);
 
         // standardize X
         if (wt_len)
@@ -234,6 +245,57 @@ public:
         }
     }
 
+    // the same as standardize() without weights, except that X is 
+    // left unchanged: only the column means and scales are 
+    // computed, for solvers which apply them to X'X and X'Y 
+    // instead of to X (see get_meanX() and get_scaleX())
+    void standardize_stats(const Eigen::Ref<const MatrixXd> &X, Vector &Y)
+    {
+        Vector wts(0);
+        standardize_y(Y, wts);
+
+        for(int i = 0; i < p; i++)
+        {
+            switch(flag)
+            {
+                case 1:
+                    scaleX[i] = sd_n(X.col(i));
+                    break;
+                case 2:
+                    meanX[i] = X.col(i).mean();
+                    break;
+                case 3:
+                    meanX[i]  = X.col(i).mean();
+                    scaleX[i] = sd_n(X.col(i));
+                    break;
+                default:
+                    break;
+            }
+        }
+    }
+
+    // the largest |mean| / sd over the columns of X after 
+    // standardize_stats(). centering X'X as X'X - n m m' loses 
+    // about the square of this ratio in relative accuracy
+    double max_mean_sd_ratio(const Eigen::Ref<const MatrixXd> &X) const
+    {
+        double ratio = 0.0;
+        if (flag < 2)
+        {
+            return ratio;
+        }
+        
+        for(int i = 0; i < p; i++)
+        {
+            double sd = (flag == 3) ? scaleX[i] : sd_n(X.col(i));
+            if (meanX[i] != 0.0)
+            {
+                ratio = std::max(ratio, std::abs(meanX[i]) / sd);
+            }
+        }
+        return ratio;
+    }
+
     void recover(double &beta0, ArrayRef coef)
     {
         switch(flag)
@@ -287,6 +349,10 @@ public:
     }
 
     double get_scaleY() { return scaleY; }
+
+    // empty when X is not centered or scaled
+    Vector get_meanX() const { return meanX.matrix(); }
+    Vector get_scaleX() const { return scaleX.matrix(); }
 };
 
 
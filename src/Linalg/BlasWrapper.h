@@ -77,6 +77,18 @@ inline void mat_vec_prod(Eigen::VectorXd &res, ConstGenericMatrix &X, ConstGener
     dgemv_("N", &n, &p, &alpha, X.data(), &n, v.data(), &inc, &beta, res.data(), &inc);
 }
 
+// res = alpha * A * v + beta * res, A symmetric with its lower triangle referenced
+inline void sym_mat_vec_prod(Eigen::VectorXd &res, ConstGenericMatrix &A, ConstGenericVector &v,
+                             const double &alpha = 1.0, const double &beta = 0.0)
+{
+    const int p = A.rows();
+    const int lda = A.outerStride();
+    const int inc = 1;
+
+    res.resize(p);
+    dsymv_("L", &p, &alpha, A.data(), &lda, v.data(), &inc, &beta, res.data(), &inc);
+}
+
 inline void mat_vec_tprod(Eigen::VectorXd &res, ConstGenericMatrix &X, ConstGenericVector &v,
                           const double &alpha = 1.0, const double &beta = 0.0)
 {
@@ -0,0 +1,331 @@
+#ifndef GRAM_H
+#define GRAM_H
+
+#include <Eigen/Core>
+#include <vector>
+#include <utility>
+#include <algorithm>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+namespace Linalg {
+
+
+// res += X' * diag(weights) * X (weights may be NULL for X'X),
+// computed as a tiled symmetric rank-k update. the lower triangle
+// of res is split into square tiles of tile_size columns and each
+// thread owns whole output tiles, so no thread holds a partial Gram
+// and there is no reduction between threads. a tile is accumulated
+// over panels of panel_rows rows of X, which keeps the columns it
+// reads in cache. the upper triangle is filled in by symmetry,
+// so res is a full symmetric matrix as the solvers expect.
+// weights are applied to one side of each product as the panel
+// is read, so no sqrt(W) * X copy of the data is ever formed.
+// res must already be p x p and may be a block of a larger
+// matrix; Grams of row blocks of X can be accumulated by calling
+// this once per block. X may hold any scalar type; blocks are 
+// converted to double as they are read
+template <typename MatType>
+void gram_tiled_update(Eigen::Ref<Eigen::MatrixXd> res, const MatType &X, const double *weights,
+                       int nthreads, int tile_size = 128, int panel_rows = 2048)
+{
+    const int n = X.rows();
+    const int p = X.cols();
+
+    const int ntiles = (p + tile_size - 1) / tile_size;
+
+    // tiles of the lower triangle, (row tile, column tile)
+    std::vector<std::pair<int, int> > tiles;
+    tiles.reserve(ntiles * (ntiles + 1) / 2);
+    for (int ti = 0; ti < ntiles; ++ti)
+    {
+        for (int tj = 0; tj <= ti; ++tj)
+        {
+            tiles.push_back(std::make_pair(ti, tj));
+        }
+    }
+    const int nt = tiles.size();
+
+    nthreads = std::max(1, std::min(nthreads, nt));
+
+    // with weights the rows of a tile are scaled in blocks
+    // small enough to stay in cache until the product reads them
+    const int row_step = weights ? std::min(panel_rows, 256) : panel_rows;
+
+    #pragma omp parallel num_threads(nthreads)
+    {
+        // weighted rows of the current panel, at most
+        // row_step x tile_size and only used with weights
+        Eigen::MatrixXd wpanel;
+
+        #pragma omp for schedule(dynamic, 1)
+        for (int t = 0; t < nt; ++t)
+        {
+            const int i0 = tiles[t].first  * tile_size;
+            const int j0 = tiles[t].second * tile_size;
+            const int ni = std::min(tile_size, p - i0);
+            const int nj = std::min(tile_size, p - j0);
+            const bool diag = (i0 == j0);
+
+            Eigen::Block<Eigen::Ref<Eigen::MatrixXd> > C = res.block(i0, j0, ni, nj);
+
+            for (int r0 = 0; r0 < n; r0 += row_step)
+            {
+                const int nr = std::min(row_step, n - r0);
+
+                if (weights)
+                {
+                    Eigen::Map<const Eigen::VectorXd> w(weights + r0, nr);
+                    wpanel.noalias() = w.asDiagonal() * X.block(r0, j0, nr, nj).template cast<double>();
+                    if (diag)
+                    {
+                        // only the lower half of a diagonal tile is needed
+                        C.triangularView<Eigen::Lower>() += X.block(r0, i0, nr, ni).template cast<double>().transpose() * wpanel;
+                    } else
+                    {
+                        C.noalias() += X.block(r0, i0, nr, ni).template cast<double>().transpose() * wpanel;
+                    }
+                } else if (diag)
+                {
+                    C.selfadjointView<Eigen::Lower>().rankUpdate(X.block(r0, i0, nr, ni).template cast<double>().adjoint());
+                } else
+                {
+                    C.noalias() += X.block(r0, i0, nr, ni).template cast<double>().transpose() * 
+                                   X.block(r0, j0, nr, nj).template cast<double>();
+                }
+            }
+
+            // mirror the tile into the upper triangle
+            if (diag)
+            {
+                for (int c = 1; c < nj; ++c)
+                {
+                    for (int r = 0; r < c; ++r)
+                    {
+                        C(r, c) = C(c, r);
+                    }
+                }
+            } else
+            {
+                res.block(j0, i0, nj, ni) = C.transpose();
+            }
+        }
+    }
+}
+
+
+// res = X' * diag(weights) * X, see gram_tiled_update()
+template <typename MatType>
+void gram_tiled(Eigen::MatrixXd &res, const MatType &X, const double *weights,
+                int nthreads, int tile_size = 128, int panel_rows = 2048)
+{
+    res.setZero(X.cols(), X.cols());
+    gram_tiled_update(res, X, weights, nthreads, tile_size, panel_rows);
+}
+
+
+// res[k] += X_k' * diag(weights_k) * X_k for every fold k, where
+// X_k holds the rows i of X with fold[i] == k (zero based; rows
+// with a fold outside 0, ..., res.size() - 1 are skipped). all the
+// fold Grams come from one pass over X: the rows are ordered by
+// fold once, and each thread owns whole output tiles of every
+// fold, as in gram_tiled_update(). for a tile, the rows of each
+// fold are read panel_rows at a time into small buffers of the
+// tile's columns, so no fold's rows are ever copied out of X as a
+// whole and X may stay column major. each res[k] must already be
+// p x p and is a full symmetric matrix on return
+template <typename MatType>
+void gram_folds_update(std::vector<Eigen::MatrixXd> &res, const MatType &X, const int *fold,
+                       const double *weights, int nthreads, int tile_size = 256,
+                       int panel_rows = 1024)
+{
+    const int n = X.rows();
+    const int p = X.cols();
+    const int nfolds = res.size();
+
+    // row indices ordered by fold with a counting sort.
+    // rows of fold k are order[start[k]], ..., order[start[k+1] - 1]
+    std::vector<int> start(nfolds + 1, 0);
+    for (int i = 0; i < n; ++i)
+    {
+        if (fold[i] >= 0 && fold[i] < nfolds)
+        {
+            ++start[fold[i] + 1];
+        }
+    }
+    for (int k = 0; k < nfolds; ++k)
+    {
+        start[k + 1] += start[k];
+    }
+    std::vector<int> order(start[nfolds]);
+    std::vector<int> pos(start.begin(), start.end() - 1);
+    for (int i = 0; i < n; ++i)
+    {
+        if (fold[i] >= 0 && fold[i] < nfolds)
+        {
+            order[pos[fold[i]]++] = i;
+        }
+    }
+
+    const int ntiles = (p + tile_size - 1) / tile_size;
+
+    // tiles of the lower triangle, (row tile, column tile)
+    std::vector<std::pair<int, int> > tiles;
+    tiles.reserve(ntiles * (ntiles + 1) / 2);
+    for (int ti = 0; ti < ntiles; ++ti)
+    {
+        for (int tj = 0; tj <= ti; ++tj)
+        {
+            tiles.push_back(std::make_pair(ti, tj));
+        }
+    }
+    const int nt = tiles.size();
+
+    nthreads = std::max(1, std::min(nthreads, nt));
+
+    #pragma omp parallel num_threads(nthreads)
+    {
+        // the current panel of rows of one fold, restricted
+        // to the row and column blocks of the tile. wpanel
+        // holds the weighted rows of the column block
+        Eigen::MatrixXd ipanel, wpanel;
+
+        #pragma omp for schedule(dynamic, 1)
+        for (int t = 0; t < nt; ++t)
+        {
+            const int i0 = tiles[t].first  * tile_size;
+            const int j0 = tiles[t].second * tile_size;
+            const int ni = std::min(tile_size, p - i0);
+            const int nj = std::min(tile_size, p - j0);
+            const bool diag = (i0 == j0);
+
+            for (int k = 0; k < nfolds; ++k)
+            {
+                Eigen::Block<Eigen::MatrixXd> C = res[k].block(i0, j0, ni, nj);
+
+                for (int s0 = start[k]; s0 < start[k + 1]; s0 += panel_rows)
+                {
+                    const int nr = std::min(panel_rows, start[k + 1] - s0);
+                    const int *rows = &order[s0];
+
+                    ipanel.resize(nr, ni);
+                    for (int c = 0; c < ni; ++c)
+                    {
+                        for (int r = 0; r < nr; ++r)
+                        {
+                            ipanel(r, c) = double(X.coeff(rows[r], i0 + c));
+                        }
+                    }
+
+                    if (diag && !weights)
+                    {
+                        C.selfadjointView<Eigen::Lower>().rankUpdate(ipanel.adjoint());
+                        continue;
+                    }
+
+                    if (diag)
+                    {
+                        wpanel = ipanel;
+                    } else
+                    {
+                        wpanel.resize(nr, nj);
+                        for (int c = 0; c < nj; ++c)
+                        {
+                            for (int r = 0; r < nr; ++r)
+                            {
+                                wpanel(r, c) = double(X.coeff(rows[r], j0 + c));
+                            }
+                        }
+                    }
+
+                    if (weights)
+                    {
+                        for (int r = 0; r < nr; ++r)
+                        {
+                            wpanel.row(r) *= weights[rows[r]];
+                        }
+                    }
+
+                    if (diag)
+                    {
+                        // only the lower half of a diagonal tile is needed
+                        C.triangularView<Eigen::Lower>() += ipanel.transpose() * wpanel;
+                    } else
+                    {
+                        C.noalias() += ipanel.transpose() * wpanel;
+                    }
+                }
+
+                // mirror the tile into the upper triangle
+                if (diag)
+                {
+                    for (int c = 1; c < nj; ++c)
+                    {
+                        for (int r = 0; r < c; ++r)
+                        {
+                            C(r, c) = C(c, r);
+                        }
+                    }
+                } else
+                {
+                    res[k].block(j0, i0, nj, ni) = C.transpose();
+                }
+            }
+        }
+    }
+}
+
+
+// res = X * X', the n x n counterpart of gram_tiled used when
+// p > n, as rank-k updates over blocks of block_cols columns
+// so that X of another scalar type is converted to double one
+// block at a time. res is a full symmetric matrix
+template <typename MatType>
+void outer_gram(Eigen::MatrixXd &res, const MatType &X, int block_cols = 256)
+{
+    const int n = X.rows();
+    const int p = X.cols();
+
+    res.setZero(n, n);
+    for (int c0 = 0; c0 < p; c0 += block_cols)
+    {
+        const int nc = std::min(block_cols, p - c0);
+        res.selfadjointView<Eigen::Lower>().rankUpdate(X.middleCols(c0, nc).template cast<double>());
+    }
+
+    for (int j = 1; j < n; ++j)
+    {
+        for (int i = 0; i < j; ++i)
+        {
+            res(i, j) = res(j, i);
+        }
+    }
+}
+
+
+// res = W^{1/2} * X * X' * W^{1/2}. X * X' is formed from X 
+// itself and the weights are applied to its rows and columns 
+// afterwards, instead of scaling a copy of X
+template <typename MatType>
+void outer_gram_weighted(Eigen::MatrixXd &res, const MatType &X, const Eigen::VectorXd &weights)
+{
+    const int n = X.rows();
+
+    outer_gram(res, X);
+
+    Eigen::VectorXd w_sqrt = weights.array().sqrt();
+    for (int j = 0; j < n; ++j)
+    {
+        for (int i = 0; i < n; ++i)
+        {
+            res(i, j) *= w_sqrt(i) * w_sqrt(j);
+        }
+    }
+}
+
+
+} // namespace Linalg
+
+#endif // GRAM_H
@@ -3,6 +3,10 @@
 
 #include <RcppEigen.h>
 #include "utils.h"
+#include "oem_penalty.h"
+#include "Spectra/SymEigsSolver.h"
+#include "Linalg/BlasWrapper.h"
+#include <limits>
 
 
 template<typename VecTypeBeta>
@@ -29,12 +33,487 @@ protected:
     Eigen::RowVectorXd colmeans;      // column means of X
     Eigen::RowVectorXd colstd;        // column std devs of X
     
+    VectorXi groups;                  // vector of group membersihp indexes 
+    VectorXi unique_groups;           // vector of all unique groups
+    VectorXd penalty_factor;          // penalty multiplication factors 
+    VectorXd group_weights;           // group lasso penalty multiplication factors 
+    bool default_group_weights;       // do we need to compute default group weights?
+    bool found_grp_idx;
+    
+    GroupIndex grp_idx;               // indexes for all members of each group
+    std::string penalty;              // penalty specified
+    
+    double d;                         // d value (largest eigenvalue of X'X)
+    VectorXd eig_vec;                 // leading eigenvector of the last X'X d was computed for
+    double eig_val;                   // upper bound on the largest eigenvalue of that X'X
+    double lambda;                    // L1 penalty
+    double alpha;                     // alpha = mixing parameter for elastic net
+    double gamma;                     // extra tuning parameter for mcp/scad
+    double tau;                       // mixing parameter for group sparse penalties
+    
     double tol;                       // tolerance for convergence
     
-    virtual void next_beta(VecTypeBeta &res) = 0;
+    bool accelerate;                  // use Nesterov acceleration with adaptive restarts
+    double ak, ak_prev;
+    
+    // oem iterations specialized for the penalty
+    // chosen in set_penalty()
+    typedef int (oemBase::*IterFun)(int);
+    IterFun oem_iter;
+    IterFun oem_iter_multi;           // the same for several responses at once
+    
+    std::vector<int> nz_idx;          // indexes of nonzero coefficients
+    
+    VecTypeBeta beta_u;               // value of beta_prev u was last computed from
+    VectorXd beta_delta;              // change in beta_prev since u was last computed
+    int u_iter;                       // number of u updates since last full recompute
+    int u_refresh;                    // recompute u in full every u_refresh iterations
+    
+    bool screen;                      // use strong rule screening along the lambda path
+    bool screen_active;               // currently iterating over the screened set only
+    int screen_type;                  // 0 = no screening, 1 = by coefficient, 2 = by group.
+                                      // only convex penalties are screened
+    bool screen_net;                  // penalty level at zero is alpha * lambda
+    double lambda_prev;               // lambda of the previous solution on the path
+    std::vector<int> screen_idx;      // coefficients kept by the strong rule
+    std::vector<char> in_screen;      // indicator of membership in screen_idx
+    VectorXd screen_grad;             // gradient of the loss at beta
+    
+    bool ws_active;                   // iterating on the working set sub-Gram
+    double ws_d;                      // largest eigenvalue of the working set sub-Gram
+    MatrixXd ws_A;                    // ws_d * I - X_S'X_S for the working set S = screen_idx
+    VectorXd ws_XY;                   // X_S'Y
+    VectorXd ws_beta;                 // beta_prev restricted to the working set
+    VectorXd ws_u;                    // u restricted to the working set
+    
+    int gap_freq;                     // check the duality gap every gap_freq iterations,
+                                      // 0 = use stopRule() instead
+    double yty;                       // Y'Y scaled as X'Y is, negative if not available
+    
+    int aa_depth;                     // depth of the Anderson acceleration history, 0 = off
+    int aa_len;                       // number of columns of the history in use
+    int aa_pos;                       // next column of the history to overwrite
+    MatrixXd aa_dF;                   // differences of successive residuals beta - beta_prev
+    MatrixXd aa_dG;                   // differences of successive oem steps
+    VectorXd aa_f;                    // residual at the previous iteration
+    VectorXd aa_g;                    // oem step at the previous iteration
+    VectorXd aa_fcur;                 // residual at the current iteration
+    double aa_fnorm;                  // norm of aa_f
+    bool aa_have_prev;                // aa_f and aa_g are set
+    bool aa_extrapolated;             // beta_prev is an Anderson point, not an oem step
+    bool aa_convex;                   // penalty is convex, so Anderson acceleration is used
+    
+    MatrixXd beta_multi;              // coefficients of each response, fitting several at once
+    VectorXd lambda_multi;            // lambda for each response
+    std::vector<int> multi_active;    // responses whose iterations have not converged
+    std::vector<int> niter_multi;     // iterations for each response in the last solve_multi()
     
     virtual void next_u(VectorXd &res) = 0;
     
+    // res = d * b + X'Y - X'X * b for the responses in cols, 
+    // with the column k of b belonging to response cols[k].
+    // solvers which support several responses override this
+    virtual void next_u_multi(MatrixXd & /* res */, const MatrixXd & /* b */, 
+                              const std::vector<int> & /* cols */) 
+    {
+        throw std::invalid_argument("several responses not available for this solver");
+    }
+    
+    // fills xx_sub and xy_sub with the rows and columns of
+    // X'X and X'Y for the coefficients in idx. returns false
+    // if the solver cannot form the sub-Gram
+    virtual bool sub_gram(MatrixXd & /* xx_sub */, VectorXd & /* xy_sub */, 
+                          const std::vector<int> & /* idx */) 
+    { 
+        return false; 
+    }
+    
+    // sub-Gram from the rows and columns of xx_mult * X'X in idx
+    template <typename MatType>
+    void sub_gram_from_XX(MatrixXd &xx_sub, VectorXd &xy_sub, 
+                          const MatType &XX, const VectorXd &XY,
+                          const std::vector<int> &idx, double xx_mult = 1.0) const
+    {
+        const int nsub = idx.size();
+        
+        xx_sub.resize(nsub, nsub);
+        xy_sub.resize(nsub);
+        for (int k = 0; k < nsub; ++k)
+        {
+            for (int r = 0; r < nsub; ++r)
+            {
+                xx_sub(r, k) = xx_mult * XX(idx[r], idx[k]);
+            }
+            xy_sub(k) = XY(idx[k]);
+        }
+    }
+    
+    // the residual sum of squares nobs * (y'y - 2 b'X'Y + b'X'X b)
+    // for X'X, X'Y and y'y scaled by 1 / nobs, as the solvers keep 
+    // them. only the lower triangle of XX and the rows and columns
+    // for the nonzero coefficients of b are read, so this is 
+    // O(k^2) for k nonzero coefficients. yty must be set
+    template <typename MatType>
+    double gram_loss(const MatType &XX, const VectorXd &XY, const VectorXd &b) const
+    {
+        return gram_loss(XX, XY, b, yty);
+    }
+    
+    // the same for a response other than the solver's own, 
+    // with X'Y and y'y of that response
+    template <typename MatType>
+    double gram_loss(const MatType &XX, const VectorXd &XY, const VectorXd &b, double yty_) const
+    {
+        std::vector<int> nz;
+        nz.reserve(b.size());
+        for (int j = 0; j < b.size(); ++j)
+        {
+            if (b(j) != 0.0)
+                nz.push_back(j);
+        }
+        
+        double lin = 0.0, quad = 0.0;
+        for (std::vector<int>::size_type a = 0; a < nz.size(); ++a)
+        {
+            const int i = nz[a];
+            double row = 0.0;
+            for (std::vector<int>::size_type c = 0; c < a; ++c)
+            {
+                row += double(XX(i, nz[c])) * b(nz[c]);
+            }
+            lin  += b(i) * XY(i);
+            quad += b(i) * (2.0 * row + double(XX(i, i)) * b(i));
+        }
+        
+        // the three terms nearly cancel for a close fit, 
+        // and rounding must not make the loss negative
+        return nobs * std::max(yty_ - 2.0 * lin + quad, 0.0);
+    }
+    
+    // largest eigenvalue of a Gram matrix, with the
+    // same safety factor used for d
+    static double max_eigenvalue(const MatrixXd &XX)
+    {
+        double eigval;
+        
+        if (XX.cols() <= 10)
+        {
+            Eigen::SelfAdjointEigenSolver<MatrixXd> eigs(XX, Eigen::EigenvaluesOnly);
+            eigval = eigs.eigenvalues().maxCoeff();
+        } else 
+        {
+            Spectra::DenseSymMatProd<double> op(XX);
+            
+            Spectra::SymEigsSolver< double, Spectra::LARGEST_ALGE, Spectra::DenseSymMatProd<double> > eigs(&op, 1, 4);
+            
+            eigs.init();
+            eigs.compute(10000, 1e-10);
+            eigval = eigs.eigenvalues()[0];
+        }
+        return eigval * 1.005; // multiply by an increasing factor to be safe
+    }
+    
+    // an upper bound on the largest eigenvalue of a symmetric 
+    // matrix: the smaller of the largest absolute row sum 
+    // (Gershgorin) and the Frobenius norm. both only hold for
+    // a full symmetric matrix, so anything else is an error
+    static double eigenvalue_bound(const MatrixXd &XX)
+    {
+        const int dim = XX.cols();
+        if (XX.rows() != dim)
+        {
+            throw std::invalid_argument("eigenvalue bound needs a square matrix");
+        }
+        
+        // entries mirrored by scaling rows and columns 
+        // may differ in the last bits
+        const double tol = 1e-10 * XX.cwiseAbs().maxCoeff();
+        for (int j = 1; j < dim; ++j)
+        {
+            for (int i = 0; i < j; ++i)
+            {
+                if (std::abs(XX(i, j) - XX(j, i)) > tol)
+                {
+                    throw std::invalid_argument("eigenvalue bound needs a full symmetric matrix");
+                }
+            }
+        }
+        
+        const double gersh = XX.cwiseAbs().rowwise().sum().maxCoeff();
+        return std::min(gersh, XX.norm());
+    }
+    
+    // largest eigenvalue of a Gram matrix for d, for Gram matrices
+    // that change a little between calls (cross validation folds,
+    // IRLS steps). d must be at least the largest eigenvalue, and
+    // a warm Lanczos run with a loose tolerance can settle on a 
+    // lower eigenpair, so its Ritz value is never used for d.
+    // instead bound is an upper bound on the largest eigenvalue
+    // of XX that the caller derives from how XX differs from the
+    // Gram matrix of the last call (by Weyl's inequality or the 
+    // Loewner order), or infinity if there is none. d is the 
+    // smaller of bound and eigenvalue_bound(XX), as both hold. 
+    // the warm run, started from eig_vec, only decides whether 
+    // that is tight: if it is more than 2% above the Ritz value, 
+    // d comes from a cold solve to 1e-10 as in max_eigenvalue().
+    // eig_vec and eig_val are updated for the next call
+    double max_eigenvalue_warm(const MatrixXd &XX, double factor, double bound)
+    {
+        const int dim = XX.cols();
+        
+        if (dim <= 10)
+        {
+            Eigen::SelfAdjointEigenSolver<MatrixXd> eigs(XX);
+            eig_vec = eigs.eigenvectors().col(dim - 1);
+            eig_val = eigs.eigenvalues()(dim - 1);
+            return eig_val * factor;
+        }
+        
+        Spectra::DenseSymMatProd<double> op(XX);
+        Spectra::SymEigsSolver< double, Spectra::LARGEST_ALGE, Spectra::DenseSymMatProd<double> > eigs(&op, 1, 4);
+        
+        if (eig_vec.size() == dim)
+        {
+            const double cert = std::min(bound, eigenvalue_bound(XX));
+            
+            // a small random part keeps the start from being
+            // orthogonal to the new leading eigenvector
+            Spectra::SimpleRandom<double> rng(0);
+            VectorXd v0 = rng.random_vec(dim);
+            v0 = eig_vec + 0.01 * v0 / v0.norm();
+            
+            eigs.init(v0.data());
+            eigs.compute(1000, 1e-4);
+            
+            if (eigs.info() == Spectra::SUCCESSFUL && cert <= eigs.eigenvalues()[0] * 1.02)
+            {
+                eig_vec = eigs.eigenvectors().col(0);
+                eig_val = cert;
+                return eig_val * factor;
+            }
+        }
+        
+        eigs.init();
+        eigs.compute(10000, 1e-10);
+        
+        eig_vec = eigs.eigenvectors().col(0);
+        eig_val = eigs.eigenvalues()[0];
+        return eig_val * factor;
+    }
+    
+    // sets up the sub-problem on the working set S = screen_idx.
+    // its majorization constant is the largest eigenvalue of
+    // X_S'X_S, which can be much smaller than d
+    bool init_working_set()
+    {
+        if (screen_idx.size() < 1 || !sub_gram(ws_A, ws_XY, screen_idx))
+            return false;
+        
+        ws_d = max_eigenvalue(ws_A);
+        
+        ws_A = -ws_A;
+        ws_A.diagonal().array() += ws_d;
+        
+        ws_beta.resize(screen_idx.size());
+        ws_u.resize(screen_idx.size());
+        return true;
+    }
+    
+    // u on the working set: u_S = A_S * beta_S + X_S'Y, zero elsewhere
+    void next_u_working_set(VectorXd &res)
+    {
+        const int nsub = screen_idx.size();
+        for (int k = 0; k < nsub; ++k)
+        {
+            ws_beta(k) = beta_prev(screen_idx[k]);
+        }
+        
+        ws_u.noalias() = ws_A * ws_beta + ws_XY;
+        
+        res.setZero();
+        for (int k = 0; k < nsub; ++k)
+        {
+            res(screen_idx[k]) = ws_u(k);
+        }
+    }
+    
+    // computes res += A * b where A = dI - xx_mult * XX is never formed.
+    // only the lower triangle of the symmetric XX needs to be valid
+    // for the dense product, which is a symmetric GEMV. when b is 
+    // sparse only the columns of XX matching the nonzero elements 
+    // of b are touched; once the support of b grows past a
+    // fraction of its length the symmetric GEMV is used instead.
+    // xx_mult lets XX be kept as sums rather than means
+    template <typename MatType>
+    void add_sparse_A_prod(VectorXd &res, const MatType &XX, const VectorXd &b, 
+                           double xx_mult = 1.0)
+    {
+        const int bsize  = b.size();
+        const int max_nz = bsize / 4;
+        
+        // when screening, only the rows of the
+        // screened coefficients are needed
+        const bool row_subset = screen_rows();
+        
+        nz_idx.clear();
+        for (int j = 0; j < bsize; ++j)
+        {
+            if (b(j) != 0.0)
+            {
+                if (int(nz_idx.size()) >= max_nz && !row_subset)
+                {
+                    res.noalias() += d * b;
+                    if (xx_mult == 1.0)
+                    {
+                        sym_mat_vec_sub(res, XX, b);
+                    } else 
+                    {
+                        sym_mat_vec_sub(res, XX, VectorXd(xx_mult * b));
+                    }
+                    return;
+                }
+                nz_idx.push_back(j);
+            }
+        }
+        
+        if (row_subset)
+        {
+            const int nscreen = screen_idx.size();
+            for (std::vector<int>::size_type k = 0; k < nz_idx.size(); ++k)
+            {
+                int j = nz_idx[k];
+                const double bj = xx_mult * b(j);
+                const typename MatType::Scalar *col_ptr = XX.data() + XX.outerStride() * j;
+                for (int r = 0; r < nscreen; ++r)
+                {
+                    int i = screen_idx[r];
+                    res(i) -= col_ptr[i] * bj;
+                }
+                res(j) += d * b(j);
+            }
+        } else
+        {
+            for (std::vector<int>::size_type k = 0; k < nz_idx.size(); ++k)
+            {
+                int j = nz_idx[k];
+                res.noalias() -= XX.col(j).template cast<double>() * (xx_mult * b(j));
+                res(j) += d * b(j);
+            }
+        }
+    }
+    
+    // res -= XX * b for symmetric XX, using its lower triangle
+    template <typename MatType>
+    static void sym_mat_vec_sub(VectorXd &res, const MatType &XX, const VectorXd &b)
+    {
+        Linalg::sym_mat_vec_prod(res, XX, b, -1.0, 1.0);
+    }
+    
+    // res -= XX * b for a single precision symmetric XX. elements 
+    // of XX are widened as they are read, so the products and sums 
+    // are in double precision; only the bytes streamed are halved
+    static void sym_mat_vec_sub(VectorXd &res, const MatrixXf &XX, const VectorXd &b)
+    {
+        const int p = XX.cols();
+        const double *b_ptr = b.data();
+        double *res_ptr = res.data();
+        
+        for (int j = 0; j < p; ++j)
+        {
+            const float *col_ptr = XX.data() + XX.outerStride() * j;
+            const double bj = b_ptr[j];
+            double dot = 0.0;
+            
+            for (int i = j + 1; i < p; ++i)
+            {
+                res_ptr[i] -= double(col_ptr[i]) * bj;
+                dot        += double(col_ptr[i]) * b_ptr[i];
+            }
+            res_ptr[j] -= double(col_ptr[j]) * bj + dot;
+        }
+    }
+    
+    // computes res = A * b + c where A = dI - xx_mult * XX
+    template <typename MatType>
+    void sparse_A_prod(VectorXd &res, const MatType &XX, 
+                       const VectorXd &b, const VectorXd &c, 
+                       double xx_mult = 1.0)
+    {
+        res = c;
+        add_sparse_A_prod(res, XX, b, xx_mult);
+    }
+    
+    // computes res = X * b using only the
+    // columns of X for nonzero elements of b
+    template <typename MatType>
+    void sparse_design_prod(VectorXd &res, const MatType &X, const VectorXd &b)
+    {
+        const int bsize = b.size();
+        
+        nz_idx.clear();
+        for (int j = 0; j < bsize; ++j)
+        {
+            if (b(j) != 0.0)
+            {
+                if (int(nz_idx.size()) >= bsize / 4)
+                {
+                    res.noalias() = X * b;
+                    return;
+                }
+                nz_idx.push_back(j);
+            }
+        }
+        
+        res.setZero(X.rows());
+        for (std::vector<int>::size_type k = 0; k < nz_idx.size(); ++k)
+        {
+            int j = nz_idx[k];
+            res += X.col(j) * b(j);
+        }
+    }
+    
+    // computes res = X' * r. when screening only the
+    // elements for the screened coefficients are computed
+    template <typename MatType>
+    void screened_crossprod(VectorXd &res, const MatType &X, const VectorXd &r)
+    {
+        if (screen_rows())
+        {
+            res.setZero(X.cols());
+            for (std::vector<int>::size_type k = 0; k < screen_idx.size(); ++k)
+            {
+                int j = screen_idx[k];
+                res(j) = X.col(j).dot(r);
+            }
+        } else 
+        {
+            res.noalias() = X.adjoint() * r;
+        }
+    }
+    
+    // whether it pays to only compute the 
+    // rows of u for the screened coefficients
+    bool screen_rows() const
+    {
+        return (screen_active && 2 * int(screen_idx.size()) < int(u.size()));
+    }
+    
+    // updates res = A * beta_prev + XY in place from its value
+    // at the previous iteration, given the change in beta_prev
+    // since then. solvers which keep X'X override this;
+    // returning false means u must be recomputed with next_u()
+    virtual bool next_u_delta(VectorXd & /* res */, const VectorXd & /* delta */) 
+    { 
+        return false; 
+    }
+    
+    // b'X'Y for the duality gap. solvers
+    // which set yty must override this
+    virtual double xy_dot(const VectorXd & /* b */) const
+    {
+        return 0.0;
+    }
+    
     virtual bool converged()
     {
         return (stopRule(beta, beta_prev, tol));
@@ -50,16 +529,587 @@ protected:
     }
     
     
+    // gradient of the loss at beta on the full problem.
+    // u = d * beta + X'(y - X * beta) / n at beta_prev = beta
+    void compute_screen_grad()
+    {
+        beta_prev = beta;
+        next_u(u);
+        screen_grad = u - d * beta;
+    }
+    
+    // norm of the gradient over the members of group g
+    double group_grad_norm(int g) const
+    {
+        double grad_norm = 0.0;
+        for (const int *j = grp_idx.begin(g); j != grp_idx.end(g); ++j)
+        {
+            grad_norm += screen_grad(*j) * screen_grad(*j);
+        }
+        return std::sqrt(grad_norm);
+    }
+    
+    // sequential strong rule. a coefficient (or group) is 
+    // screened out if it is zero and its gradient at the 
+    // previous solution is below thresh times its penalty factor
+    void strong_set(double thresh)
+    {
+        const int nb = beta.size();
+        
+        screen_idx.clear();
+        in_screen.assign(nb, 0);
+        
+        if (screen_type == 1)
+        {
+            for (int j = 0; j < nb; ++j)
+            {
+                double pen_fact = (j < penalty_factor.size()) ? penalty_factor(j) : 0.0;
+                
+                if (beta(j) != 0.0 || std::abs(screen_grad(j)) >= pen_fact * thresh)
+                {
+                    screen_idx.push_back(j);
+                    in_screen[j] = 1;
+                }
+            }
+        } else
+        {
+            for (int g = 0; g < ngroups; ++g)
+            {
+                const int *gr_begin = grp_idx.begin(g);
+                const int *gr_end   = grp_idx.end(g);
+                
+                bool keep = (unique_groups(g) == 0); // the 0 group is unpenalized
+                for (const int *j = gr_begin; j != gr_end && !keep; ++j)
+                {
+                    keep = (beta(*j) != 0.0);
+                }
+                
+                if (keep || group_grad_norm(g) >= group_weights(g) * thresh)
+                {
+                    for (const int *j = gr_begin; j != gr_end; ++j)
+                    {
+                        screen_idx.push_back(*j);
+                        in_screen[*j] = 1;
+                    }
+                }
+            }
+        }
+    }
+    
+    // KKT check for the screened out coefficients at penalty
+    // level lam. violators are added to the screened set.
+    // returns true if there were any violations
+    bool kkt_violations(double lam)
+    {
+        const int nb = beta.size();
+        bool violation = false;
+        
+        if (screen_type == 1)
+        {
+            for (int j = 0; j < nb; ++j)
+            {
+                double pen_fact = (j < penalty_factor.size()) ? penalty_factor(j) : 0.0;
+                
+                if (!in_screen[j] && std::abs(screen_grad(j)) > pen_fact * lam)
+                {
+                    screen_idx.push_back(j);
+                    in_screen[j] = 1;
+                    violation = true;
+                }
+            }
+        } else
+        {
+            for (int g = 0; g < ngroups; ++g)
+            {
+                const int *gr_begin = grp_idx.begin(g);
+                const int *gr_end   = grp_idx.end(g);
+                
+                if (gr_begin == gr_end || in_screen[*gr_begin])
+                    continue;
+                
+                if (group_grad_norm(g) > group_weights(g) * lam)
+                {
+                    for (const int *j = gr_begin; j != gr_end; ++j)
+                    {
+                        screen_idx.push_back(*j);
+                        in_screen[*j] = 1;
+                    }
+                    violation = true;
+                }
+            }
+        }
+        
+        return violation;
+    }
+    
+    // oem over the coefficients kept by the strong rule, 
+    // re-solving with any KKT violators added back in.
+    // the kept coefficients form the working set
+    int screened_solve(int maxit)
+    {
+        double lam_fact = screen_net ? alpha : 1.0;
+        double lam_cur  = lambda * lam_fact;
+        double lam_last = (lambda_prev > 0.0 ? lambda_prev : lambda) * lam_fact;
+        
+        lambda_prev = lambda;
+        
+        if (lam_cur <= 0.0)
+        {
+            return run_oem(maxit);
+        }
+        
+        compute_screen_grad();
+        strong_set(2.0 * lam_cur - lam_last);
+        
+        int iters = 0;
+        while (true)
+        {
+            screen_active = (int(screen_idx.size()) < beta.size());
+            
+            // solve on the working set with its own d 
+            // when the solver can form the sub-Gram
+            ws_active = (screen_active && init_working_set());
+            
+            double d_full = d;
+            if (ws_active)
+            {
+                d = ws_d;
+            }
+            
+            iters += run_oem(maxit);
+            
+            d = d_full;
+            ws_active = false;
+            
+            if (!screen_active)
+                break;
+            
+            screen_active = false;
+            compute_screen_grad();
+            
+            if (!kkt_violations(lam_cur))
+                break;
+        }
+        
+        return iters;
+    }
+    
+    // whether convergence is decided by the duality gap. 
+    // the gap is only available for the convex penalties 
+    // that are screened, with a positive l1 or group 
+    // penalty level, and when the solver knows Y'Y
+    bool use_duality_gap() const
+    {
+        double lam = screen_net ? lambda * alpha : lambda;
+        return (gap_freq > 0 && screen_type > 0 && lam > 0.0 && yty >= 0.0);
+    }
+    
+    // duality gap at beta_prev for the current penalty, 
+    // relative to the objective at beta = 0. u must be 
+    // d * beta_prev + X'(Y - X * beta_prev) / n, so that the 
+    // gradient and ||Y - X * beta_prev||^2 / n only need inner 
+    // products of length p. the dual point is the residual 
+    // rescaled to be feasible for the penalized coefficients.
+    // it is only feasible for the unpenalized coefficients once
+    // their gradient vanishes, so the largest such gradient 
+    // relative to the penalty level is returned if it is larger.
+    // the elastic net ridge term is handled as the lasso on
+    // data augmented by sqrt(lambda * (1 - alpha)) * I
+    double duality_gap() const
+    {
+        const int nb    = beta_prev.size();
+        const double lam   = screen_net ? lambda * alpha : lambda;
+        const double ridge = screen_net ? lambda * (1.0 - alpha) : 0.0;
+        
+        double bb = 0.0, bu = 0.0;
+        for (int j = 0; j < nb; ++j)
+        {
+            bb += beta_prev(j) * beta_prev(j);
+            bu += beta_prev(j) * u(j);
+        }
+        double bxy = xy_dot(beta_prev);
+        
+        // beta' X'X beta = d * beta'beta + beta'X'Y - beta'u
+        double resid_ss = yty - bxy + (d + ridge) * bb - bu;
+        resid_ss = std::max(resid_ss, 0.0);
+        
+        // beta' times the negative gradient of the smooth part
+        double bgrad = bu - (d + ridge) * bb;
+        
+        double pen = 0.0, dual_norm = 0.0, unpen_grad = 0.0;
+        if (screen_type == 1)
+        {
+            for (int j = 0; j < nb; ++j)
+            {
+                double pen_fact = (j < penalty_factor.size()) ? penalty_factor(j) : 0.0;
+                double grad_j   = u(j) - (d + ridge) * beta_prev(j);
+                if (pen_fact > 0.0)
+                {
+                    pen      += pen_fact * std::abs(beta_prev(j));
+                    dual_norm = std::max(dual_norm, std::abs(grad_j) / pen_fact);
+                } else
+                {
+                    unpen_grad = std::max(unpen_grad, std::abs(grad_j));
+                }
+            }
+        } else
+        {
+            for (int g = 0; g < ngroups; ++g)
+            {
+                bool penalized = (unique_groups(g) != 0 && group_weights(g) > 0.0);
+                
+                double beta_norm = 0.0, grad_norm = 0.0;
+                for (const int *gr_j = grp_idx.begin(g); gr_j != grp_idx.end(g); ++gr_j)
+                {
+                    int j = *gr_j;
+                    double grad_j = u(j) - (d + ridge) * beta_prev(j);
+                    beta_norm += beta_prev(j) * beta_prev(j);
+                    grad_norm += grad_j * grad_j;
+                    if (!penalized)
+                    {
+                        unpen_grad = std::max(unpen_grad, std::abs(grad_j));
+                    }
+                }
+                if (penalized)
+                {
+                    pen      += group_weights(g) * std::sqrt(beta_norm);
+                    dual_norm = std::max(dual_norm, std::sqrt(grad_norm) / group_weights(g));
+                }
+            }
+        }
+        
+        double scale = (dual_norm > lam) ? lam / dual_norm : 1.0;
+        
+        double gap = 0.5 * std::pow(1.0 - scale, 2) * resid_ss - scale * bgrad + lam * pen;
+        gap /= std::max(0.5 * yty, 1e-300);
+        
+        return std::max(gap, unpen_grad / lam);
+    }
+    
+    // the oem iterations for one penalty. the penalty is
+    // a compile-time policy (see oem_penalty.h), so the
+    // thresholding step is inlined into this loop
+    template <typename Penalty>
+    int oem_iterations(int maxit)
+    {
+        const PenaltyParams par = {lambda, alpha, gamma, tau, d,
+                                   penalty_factor, group_weights,
+                                   grp_idx, unique_groups, ngroups};
+        int i;
+        
+        const bool gap_stop = use_duality_gap();
+        const bool anderson = (aa_depth > 0 && aa_convex);
+        
+        // A or XY may have changed since the last 
+        // call, so the first u is computed in full
+        u_iter = 0;
+        
+        // as may the oem map, so the Anderson history is stale
+        if (anderson)
+            anderson_reset();
+        
+        for(i = 0; i < maxit; ++i)
+        {
+            
+            beta_prev = beta;
+            
+            update_u();
+            
+            // the gap certifies beta_prev. the oem step from 
+            // beta_prev does not increase the objective, so it 
+            // certifies the new beta as well
+            bool gap_check = (gap_stop && (i + 1) % gap_freq == 0);
+            double gap = gap_check ? duality_gap() : 0.0;
+            
+            Penalty::prox(beta, u, par);
+            
+            if (gap_check && gap <= tol)
+                break;
+            
+            // convergence is checked on the plain oem 
+            // step, before any Anderson extrapolation
+            if (anderson)
+            {
+                if (!gap_stop && converged())
+                    break;
+                
+                anderson_beta();
+                continue;
+            }
+            
+            if (accelerate)
+                accelerate_beta();
+            
+            if(!gap_stop && converged())
+                break;
+            
+        }
+        
+        
+        return i + 1;
+    }
+    
+    // the oem iterations for several responses sharing X'X. 
+    // u for all responses not yet converged is computed with
+    // one matrix-matrix product, then each column is thresholded
+    // with its own lambda. a response leaves the batch once its
+    // coefficients converge, so later products are narrower
+    template <typename Penalty>
+    int oem_iterations_multi(int maxit)
+    {
+        const int nresp = beta_multi.cols();
+        
+        multi_active.resize(nresp);
+        niter_multi.assign(nresp, 0);
+        for (int k = 0; k < nresp; ++k)
+        {
+            multi_active[k] = k;
+        }
+        
+        MatrixXd b_act, u_act;
+        VectorXd b_k(nvars), b_prev_k(nvars), u_k(nvars);
+        
+        int i;
+        for(i = 0; i < maxit && !multi_active.empty(); ++i)
+        {
+            const int nact = multi_active.size();
+            
+            b_act.resize(nvars, nact);
+            for (int k = 0; k < nact; ++k)
+            {
+                b_act.col(k) = beta_multi.col(multi_active[k]);
+            }
+            
+            next_u_multi(u_act, b_act, multi_active);
+            
+            int nkeep = 0;
+            for (int k = 0; k < nact; ++k)
+            {
+                const int r = multi_active[k];
+                const PenaltyParams par = {lambda_multi(r), alpha, gamma, tau, d,
+                                           penalty_factor, group_weights,
+                                           grp_idx, unique_groups, ngroups};
+                
+                u_k      = u_act.col(k);
+                b_prev_k = b_act.col(k);
+                
+                Penalty::prox(b_k, u_k, par);
+                
+                beta_multi.col(r) = b_k;
+                ++niter_multi[r];
+                
+                if (!stopRule(b_k, b_prev_k, tol))
+                {
+                    multi_active[nkeep++] = r;
+                }
+            }
+            multi_active.resize(nkeep);
+        }
+        
+        return i;
+    }
+    
+    // Nesterov-style extrapolation with adaptive restarting
+    void accelerate_beta()
+    {
+        ak_prev = ak;
+        ak      = 0.5 * (1 + std::sqrt(1.0 + 4.0 * std::pow(ak, 2)));
+        double ratio_k = (ak_prev - 1.0) / ak;
+        
+        VectorXd beta_update = beta;
+        VectorXd beta_diff = beta - beta_prev;
+        beta.array() += ratio_k * beta_diff.array();
+        
+        double adaptive_val = ((beta.array() - beta_update.array()).array() * 
+                               beta_diff.array()).sum();
+        
+        if (adaptive_val > 0)
+        {
+            ak = 1;
+        }
+    }
+    
+    void anderson_reset()
+    {
+        const int nb = beta.size();
+        if (aa_dF.rows() != nb || aa_dF.cols() != aa_depth)
+        {
+            aa_dF.resize(nb, aa_depth);
+            aa_dG.resize(nb, aa_depth);
+        }
+        aa_len          = 0;
+        aa_pos          = 0;
+        aa_have_prev    = false;
+        aa_extrapolated = false;
+    }
+    
+    // safeguarded Anderson acceleration (type II) of the oem map
+    // beta_prev -> beta. the next point is the combination of the 
+    // last aa_depth oem steps whose residuals beta - beta_prev
+    // combine to the smallest norm. if the residual at an 
+    // extrapolated point is larger than at the point it was
+    // extrapolated from, the extrapolation is discarded for the
+    // plain oem step from that point and the history is cleared
+    void anderson_beta()
+    {
+        aa_fcur = beta - beta_prev;
+        double fnorm = aa_fcur.norm();
+        
+        if (aa_extrapolated && fnorm > aa_fnorm)
+        {
+            beta = aa_g;
+            aa_len          = 0;
+            aa_pos          = 0;
+            aa_have_prev    = false;
+            aa_extrapolated = false;
+            return;
+        }
+        
+        if (aa_have_prev)
+        {
+            aa_dF.col(aa_pos) = aa_fcur - aa_f;
+            aa_dG.col(aa_pos) = beta - aa_g;
+            aa_pos = (aa_pos + 1) % aa_depth;
+            aa_len = std::min(aa_len + 1, aa_depth);
+        }
+        
+        aa_f.swap(aa_fcur);
+        aa_g            = beta;
+        aa_fnorm        = fnorm;
+        aa_have_prev    = true;
+        aa_extrapolated = false;
+        
+        if (aa_len < 1 || fnorm <= 0.0)
+            return;
+        
+        // least squares for the combination weights through
+        // the (aa_len x aa_len) normal equations, lightly 
+        // regularized as the differences are often nearly collinear
+        const Eigen::Ref<const MatrixXd> dF = aa_dF.leftCols(aa_len);
+        MatrixXd FtF = dF.transpose() * dF;
+        VectorXd Ftf = dF.transpose() * aa_f;
+        FtF.diagonal().array() += 1e-10 * FtF.diagonal().maxCoeff() + 1e-300;
+        
+        VectorXd gamma_aa = FtF.ldlt().solve(Ftf);
+        if (!gamma_aa.allFinite())
+            return;
+        
+        beta.noalias() -= aa_dG.leftCols(aa_len) * gamma_aa;
+        aa_extrapolated = true;
+    }
+    
+    template <typename Penalty>
+    void set_prox()
+    {
+        oem_iter       = &oemBase::template oem_iterations<Penalty>;
+        oem_iter_multi = &oemBase::template oem_iterations_multi<Penalty>;
+    }
+    
+    // resolve the penalty string once, rather 
+    // than on every oem iteration
+    void set_penalty(const std::string &penalty_)
+    {
+        penalty = penalty_;
+        
+        // a new penalty starts a new path
+        lambda_prev = -1.0;
+        
+        if (penalty == "lasso")
+        {
+            set_prox<ProxLasso>();
+            screen_type = 1;
+            screen_net  = false;
+        } else if (penalty == "ols")
+        {
+            set_prox<ProxOls>();
+            screen_type = 0;
+            screen_net  = false;
+        } else if (penalty == "elastic.net")
+        {
+            set_prox<ProxElasticNet>();
+            screen_type = 1;
+            screen_net  = true;
+        } else if (penalty == "scad")
+        {
+            set_prox<ProxScad>();
+            screen_type = 0;
+            screen_net  = false;
+        } else if (penalty == "scad.net")
+        {
+            set_prox<ProxScadNet>();
+            screen_type = 0;
+            screen_net  = true;
+        } else if (penalty == "mcp")
+        {
+            set_prox<ProxMcp>();
+            screen_type = 0;
+            screen_net  = false;
+        } else if (penalty == "mcp.net")
+        {
+            set_prox<ProxMcpNet>();
+            screen_type = 0;
+            screen_net  = true;
+        } else if (penalty == "grp.lasso")
+        {
+            set_prox<ProxGrpLasso>();
+            screen_type = 2;
+            screen_net  = false;
+        } else if (penalty == "grp.lasso.net")
+        {
+            set_prox<ProxGrpLassoNet>();
+            screen_type = 2;
+            screen_net  = true;
+        } else if (penalty == "grp.mcp")
+        {
+            set_prox<ProxGrpMcp>();
+            screen_type = 0;
+            screen_net  = false;
+        } else if (penalty == "grp.scad")
+        {
+            set_prox<ProxGrpScad>();
+            screen_type = 0;
+            screen_net  = false;
+        } else if (penalty == "grp.mcp.net")
+        {
+            set_prox<ProxGrpMcpNet>();
+            screen_type = 0;
+            screen_net  = true;
+        } else if (penalty == "grp.scad.net")
+        {
+            set_prox<ProxGrpScadNet>();
+            screen_type = 0;
+            screen_net  = true;
+        } else if (penalty == "sparse.grp.lasso")
+        {
+            set_prox<ProxSparseGrpLasso>();
+            screen_type = 0;
+            screen_net  = false;
+        } else 
+        {
+            throw std::invalid_argument("penalty not available");
+        }
+        
+        // the oem map only has a unique fixed point for the 
+        // convex penalties. for mcp and scad, extrapolating 
+        // can move the iterations to another stationary point
+        aa_convex = convex_penalty(penalty);
+    }
+    
+    
 public:
     oemBase(int n_, 
             int p_,
-            int ngroups_,
+            const VectorXi &groups_,
+            const VectorXi &unique_groups_,
+            const VectorXd &group_weights_,
+            const VectorXd &penalty_factor_,
             bool intercept_,
             bool standardize_,
-            double tol_ = 1e-6) :
+            double tol_ = 1e-6,
+            bool accelerate_ = false) :
     nvars(p_), 
     nobs(n_),
-    ngroups(ngroups_),
+    ngroups(unique_groups_.size()),
     intercept(intercept_),
     standardize(standardize_),
     u(p_),               // allocate space but do not set values
@@ -68,45 +1118,183 @@ public:
     beta_prev_irls(p_),
     colmeans(p_),
     colstd(p_),
-    tol(tol_)
-    {}
+    groups(groups_),
+    unique_groups(unique_groups_),
+    penalty_factor(penalty_factor_),
+    group_weights(group_weights_),
+    default_group_weights(bool(group_weights_.size() < 1)), // compute default weights if none given
+    found_grp_idx(false),
+    eig_val(0.0),
+    tol(tol_),
+    accelerate(accelerate_),
+    ak(1.0),
+    ak_prev(1.0),
+    oem_iter(&oemBase::template oem_iterations<ProxLasso>),
+    oem_iter_multi(&oemBase::template oem_iterations_multi<ProxLasso>),
+    u_iter(0),
+    u_refresh(50),
+    screen(false),
+    screen_active(false),
+    screen_type(0),
+    screen_net(false),
+    lambda_prev(-1.0),
+    ws_active(false),
+    ws_d(0.0),
+    gap_freq(0),
+    yty(-1.0),
+    aa_depth(0),
+    aa_len(0),
+    aa_pos(0),
+    aa_fnorm(0.0),
+    aa_have_prev(false),
+    aa_extrapolated(false),
+    aa_convex(false)
+    {
+        nz_idx.reserve(p_);
+    }
     
     virtual ~oemBase() {}
     
     void update_u()
     {
-        //VecTypeBeta newbeta(nvars);
+        if (ws_active)
+        {
+            next_u_working_set(u);
+            return;
+        }
+        
+        // between full recomputes only the columns of A 
+        // for coefficients that changed are needed. this is
+        // only used when fewer coefficients changed than are 
+        // nonzero, otherwise a recompute touches fewer columns
+        if (u_iter > 0 && u_iter < u_refresh)
+        {
+            int nz_delta = 0, nz_beta = 0;
+            beta_delta.resize(beta_prev.size());
+            for (int j = 0; j < beta_prev.size(); ++j)
+            {
+                beta_delta(j) = beta_prev(j) - beta_u(j);
+                nz_delta += (beta_delta(j) != 0.0);
+                nz_beta  += (beta_prev(j) != 0.0);
+            }
+            
+            if (nz_delta < nz_beta && next_u_delta(u, beta_delta))
+            {
+                beta_u = beta_prev;
+                ++u_iter;
+                screen_u();
+                return;
+            }
+        }
+        
         next_u(u);
-        //beta.swap(newbeta);
+        beta_u = beta_prev;
+        u_iter = 1;
+        screen_u();
     }
     
-    void update_beta()
+    // zero u for the coefficients screened out so that
+    // the thresholding step keeps them at zero
+    void screen_u()
     {
-        //VecTypeBeta newbeta(nvars);
-        next_beta(beta);
-        //beta.swap(newbeta);
+        if (screen_active)
+        {
+            for (int j = 0; j < u.size(); ++j)
+            {
+                if (!in_screen[j])
+                    u(j) = 0.0;
+            }
+        }
     }
     
+    // run the oem iterations for the current penalty
+    int run_oem(int maxit)
+    {
+        return (this->*oem_iter)(maxit);
+    }
+    
+    // whether a penalty is convex, so that its solution does
+    // not depend on the path of warm starts leading to it
+    static bool convex_penalty(const std::string &penalty_)
+    {
+        return (penalty_ == "ols" || penalty_ == "lasso" || penalty_ == "elastic.net" ||
+                penalty_ == "grp.lasso" || penalty_ == "grp.lasso.net" || 
+                penalty_ == "sparse.grp.lasso");
+    }
+    
+    // copy the iteration options of another solver for the
+    // same problem, e.g. one fitting another part of the path
+    void copy_options(const oemBase &other)
+    {
+        accelerate = other.accelerate;
+        gap_freq   = other.gap_freq;
+        yty        = other.yty;
+        aa_depth   = other.aa_depth;
+        screen     = other.screen;
+    }
+    
+    // start the iterations for the current lambda from 
+    // beta_ rather than from the previous solution
+    void warm_start(const VecTypeBeta &beta_)
+    {
+        beta = beta_;
+    }
+    
+    // safeguarded Anderson acceleration with a history of 
+    // depth iterations. depth = 0 turns it off. when on, it is
+    // used in place of the Nesterov acceleration for convex penalties
+    void set_anderson(int depth)
+    {
+        aa_depth = std::max(depth, 0);
+    }
+    
+    // strong rule screening with a KKT check along the 
+    // lambda path. only used by the least squares solvers
+    // and only for convex penalties. off by default
+    void set_screen(bool screen_)
+    {
+        screen = screen_;
+    }
+    
+    // check convergence with the duality gap every 
+    // freq iterations instead of with stopRule(). 
+    // freq = 0 restores stopRule()
+    void set_gap_freq(int freq)
+    {
+        gap_freq = std::max(freq, 0);
+    }
+    
+    // lambda_(k) is the lambda for response k when fitting 
+    // several responses at once with solve_multi(). init() 
+    // sets the penalty beforehand. the previous solutions are 
+    // the starting values unless cold is true
+    void set_lambda_multi(const VectorXd &lambda_, bool cold)
+    {
+        lambda_multi = lambda_;
+        if (cold || beta_multi.cols() != lambda_.size())
+        {
+            beta_multi.setZero(nvars, lambda_.size());
+        }
+    }
+    
+    // fit all responses for the lambdas of set_lambda_multi().
+    // screening and acceleration are not used. returns the 
+    // largest number of iterations over the responses
+    int solve_multi(int maxit)
+    {
+        return (this->*oem_iter_multi)(maxit);
+    }
+    
+    const MatrixXd &get_beta_multi() const { return beta_multi; }
+    const std::vector<int> &get_niter_multi() const { return niter_multi; }
+    
     virtual int solve(int maxit)
     {
-        int i;
-        
-        for(i = 0; i < maxit; ++i)
+        if (screen && screen_type > 0)
         {
-            
-            beta_prev = beta;
-            
-            update_u();
-            
-            update_beta();
-            
-            if(converged())
-                break;
-            
+            return screened_solve(maxit);
         }
-        
-        
-        return i + 1;
+        return run_oem(maxit);
     }
     
     virtual void init_oem() {}
@@ -115,7 +1303,7 @@ public:
     virtual void update_xtx(int fold_) {}
     virtual double compute_lambda_zero() { return 0; }
     virtual VecTypeBeta get_beta() { return beta; }
-    virtual double get_d() { return 0; }
+    virtual double get_d() { return d; }
     
     Eigen::RowVectorXd get_X_colmeans() {return colmeans;}
     Eigen::RowVectorXd get_X_colstd() {return colstd;}
@@ -1,17 +1,41 @@
 #ifndef OEM_BIG_H
 #define OEM_BIG_H
 
+#ifdef _OPENMP
+    #define has_openmp 1
+    #include <omp.h>
+#else 
+    #define has_openmp 0
+    #define omp_get_num_threads() 1
+    #define omp_set_num_threads(x) 1
+    #define omp_get_max_threads() 1
+    #define omp_get_num_threads() 1
+    #define omp_get_num_procs() 1
+    #define omp_get_thread_limit() 1
+    #define omp_set_dynamic(x) 1
+    #define omp_get_thread_num() 0
+#endif
 
+#ifndef _WIN32
+    #include <sys/mman.h>
+    #include <unistd.h>
+#endif
 
 #include "oem_base.h"
 #include "Spectra/SymEigsSolver.h"
 #include "utils.h"
+#include "Linalg/Gram.h"
 #include <bigmemory/MatrixAccessor.hpp>
 #include <bigmemory/BigMatrix.h>
+#include <climits>
+#include <cfloat>
 
 
 // minimize  1/2 * ||y - X * beta||^2 + lambda * ||beta||_1
 //
+// XScalar is the element type of the big.matrix. X is read
+// in place and converted to double inside the products
+template <typename XScalar = double>
 class oemBig: public oemBase<Eigen::VectorXd> 
 {
 protected:
@@ -24,411 +48,139 @@ protected:
     typedef Map<const MatrixXd> MapMatd;
     typedef Map<const VectorXd> MapVecd;
     typedef Map<VectorXi> MapVeci;
+    typedef Eigen::Matrix<XScalar, Eigen::Dynamic, Eigen::Dynamic> XMatrix;
+    typedef Map<const XMatrix> MapXMat;
     typedef const Eigen::Ref<const Matrix> ConstGenericMatrix;
     typedef const Eigen::Ref<const Vector> ConstGenericVector;
     typedef Eigen::SparseMatrix<double> SpMat;
     typedef Eigen::SparseVector<double> SparseVector;
     
-    const MapMatd X;            // data matrix
+    const MapXMat X;            // data matrix
     MapVec Y;                   // response vector
     VectorXd weights;
-    VectorXi groups;            // vector of group membersihp indexes 
-    VectorXi unique_groups;     // vector of all unique groups
-    VectorXd penalty_factor;    // penalty multiplication factors 
-    VectorXd group_weights;     // group lasso penalty multiplication factors 
     int penalty_factor_size;    // size of penalty_factor vector
     int XXdim;                  // dimension of XX (different if n > p and p >= n)
     int XXdimCalc;
     Vector XY;                  // X'Y
     MatrixXd XX;                // X'X
-    MatrixXd A;                 // A = d * I - X'X
-    double d;                   // d value (largest eigenvalue of X'X)
-    bool default_group_weights; // do we need to compute default group weights?
     
     
-    std::vector<std::vector<int> > grp_idx; // vector of vectors of the indexes for all members of each group
-    std::string penalty;        // penalty specified
     
-    double lambda;              // L1 penalty
     double lambda0;             // minimum lambda to make coefficients all zero
-    double alpha;               // alpha = mixing parameter for elastic net
-    double gamma;               // extra tuning parameter for mcp/scad
-    double tau;                 // mixing parameter for group sparse penalties
     
     double threshval;
     int wt_len;
     int nslices;
+    int ncores;
     
     double gigs;
     Eigen::RowVectorXd colsums;
     Eigen::RowVectorXd colsq;
     Eigen::VectorXd colsq_inv;
     
-    bool found_grp_idx;
     
-    static void soft_threshold(VectorXd &res, const VectorXd &vec, const double &penalty, 
-                               VectorXd &pen_fact, double &d)
-    {
-        int v_size = vec.size();
-        res.setZero();
-        
-        const double *ptr = vec.data();
-        for(int i = 0; i < v_size; i++)
-        {
-            double total_pen = pen_fact(i) * penalty;
-            
-            if(ptr[i] > total_pen)
-                res(i) = (ptr[i] - total_pen)/d;
-            else if(ptr[i] < -total_pen)
-                res(i) = (ptr[i] + total_pen)/d;
-        }
-    }
-    
-    static void soft_threshold_mcp(VectorXd &res, const VectorXd &vec, const double &penalty, 
-                                   VectorXd &pen_fact, double &d, double &gamma)
-    {
-        int v_size = vec.size();
-        res.setZero();
-        double gammad = gamma * d;
-        double d_minus_gammainv = d - 1.0 / gamma;
-        
-        
-        const double *ptr = vec.data();
-        for(int i = 0; i < v_size; i++)
-        {
-            double total_pen = pen_fact(i) * penalty;
-            
-            if (std::abs(ptr[i]) > gammad * total_pen)
-                res(i) = ptr[i]/d;
-            else if(ptr[i] > total_pen)
-                res(i) = (ptr[i] - total_pen)/(d_minus_gammainv);
-            else if(ptr[i] < -total_pen)
-                res(i) = (ptr[i] + total_pen)/(d_minus_gammainv);
-            
-        }
-        
+    MatrixXd XXt() const {
+        MatrixXd XXtmp;
+        Linalg::outer_gram(XXtmp, X);
+        return XXtmp;
     }
     
-    static void soft_threshold_scad(VectorXd &res, const VectorXd &vec, const double &penalty, 
-                                    VectorXd &pen_fact, double &d, double &gamma)
-    {
-        int v_size = vec.size();
-        res.setZero();
-        double gammad = gamma * d;
-        double gamma_minus1_d = (gamma - 1.0) * d;
-        
-        const double *ptr = vec.data();
-        for(int i = 0; i < v_size; i++)
-        {
-            double total_pen = pen_fact(i) * penalty;
-            
-            if (std::abs(ptr[i]) > gammad * total_pen)
-                res(i) = ptr[i]/d;
-            else if (std::abs(ptr[i]) > (d + 1.0) * total_pen)
-            {
-                double gam_ptr = (gamma - 1.0) * ptr[i];
-                double gam_pen = gamma * total_pen;
-                if(gam_ptr > gam_pen)
-                    res(i) = (gam_ptr - gam_pen)/(gamma_minus1_d - 1.0);
-                else if(gam_ptr < -gam_pen)
-                    res(i) = (gam_ptr + gam_pen)/(gamma_minus1_d - 1.0);
-            }
-            else if(ptr[i] > total_pen)
-                res(i) = (ptr[i] - total_pen)/d;
-            else if(ptr[i] < -total_pen)
-                res(i) = (ptr[i] + total_pen)/d;
-            
-        }
+    MatrixXd XWXt() const {
+        MatrixXd XXtmp;
+        Linalg::outer_gram_weighted(XXtmp, X, weights);
+        return XXtmp;
     }
-    
-    static double soft_threshold_scad_norm(double &b, const double &pen, double &d, double &gamma)
-    {
-        double retval = 0.0;
-        
-        double gammad = gamma * d;
-        double gamma_minus1_d = (gamma - 1.0) * d;
-        
-        if (std::abs(b) > gammad * pen)
-            retval = 1;
-        else if (std::abs(b) > (d + 1.0) * pen)
-        {
-            double gam_ptr = (gamma - 1.0);
-            double gam_pen = gamma * pen / b;
-            if(gam_ptr > gam_pen)
-                retval = d * (gam_ptr - gam_pen)/(gamma_minus1_d - 1.0);
-            else if(gam_ptr < -gam_pen)
-                retval = d * (gam_ptr + gam_pen)/(gamma_minus1_d - 1.0);
-        }
-        else if(b > pen)
-            retval = (1.0 - pen / b);
-        else if(b < -pen)
-            retval = (1.0 + pen / b);
-        return retval;
+    /*
+    MatrixXd XXt() const {
+        return MatrixXd(nobs, nobs).setZero().selfadjointView<Lower>().
+        rankUpdate(X);
     }
     
-    static double soft_threshold_mcp_norm(double &b, const double &pen, double &d, double &gamma)
-    {
-        double retval = 0;
-        
-        double gammad = gamma * d;
-        double d_minus_gammainv = d - 1.0 / gamma;
-        
-        if (std::abs(b) > gammad * pen)
-            retval = 1;
-        else if(b > pen)
-            retval = d * (1.0 - pen / b)/(d_minus_gammainv);
-        else if(b < -pen)
-            retval = d * (1.0 + pen / b)/(d_minus_gammainv);
-        
-        return retval;
+    MatrixXd XWXt() const {
+        return MatrixXd(nobs, nobs).setZero().selfadjointView<Lower>().
+        rankUpdate( (weights.array().sqrt().matrix()).asDiagonal() * X );
     }
+     */
     
-    static void block_soft_threshold_scad(VectorXd &res, const VectorXd &vec, const double &penalty,
-                                          VectorXd &pen_fact, double &d,
-                                          std::vector<std::vector<int> > &grp_idx, 
-                                          const int &ngroups, VectorXi &unique_grps, VectorXi &grps,
-                                          double & gamma)
+    // asks the OS to start reading rows [r0, r0 + nr) of X, which 
+    // for a file-backed matrix is one segment of every column. 
+    // the read-ahead runs while the current slice is processed
+    void prefetch_rows(int r0, int nr) const
     {
-        //int v_size = vec.size();
-        res.setZero();
-        
-        for (int g = 0; g < ngroups; ++g) 
-        {
-            double thresh_factor;
-            std::vector<int> gr_idx = grp_idx[g];
-            
-            if (unique_grps(g) == 0) // the 0 group represents unpenalized variables
-            {
-                thresh_factor = 1.0;
-            } else 
-            {
-                double ds_norm = 0.0;
-                for (std::vector<int>::size_type v = 0; v < gr_idx.size(); ++v)
-                {
-                    int c_idx = gr_idx[v];
-                    ds_norm += std::pow(vec(c_idx), 2);
-                }
-                ds_norm = std::sqrt(ds_norm);
-                // double grp_wts = sqrt(gr_idx.size());
-                double grp_wts = pen_fact(g);
-                //thresh_factor = std::max(0.0, 1.0 - penalty * grp_wts / (ds_norm) );
-                thresh_factor = soft_threshold_scad_norm(ds_norm, penalty * grp_wts, d, gamma);
-            }
-            if (thresh_factor != 0.0)
-            {
-                for (std::vector<int>::size_type v = 0; v < gr_idx.size(); ++v)
-                {
-                    int c_idx = gr_idx[v];
-                    res(c_idx) = vec(c_idx) * thresh_factor / d;
-                }
-            }
+#ifndef _WIN32
+        const uintptr_t page = sysconf(_SC_PAGESIZE);
+        const int pc = X.cols();
+        for (int j = 0; j < pc; ++j)
+        {
+            const XScalar *first = X.data() + std::ptrdiff_t(j) * nobs + r0;
+            uintptr_t start = uintptr_t(first) & ~(page - 1);
+            uintptr_t end   = uintptr_t(first + nr);
+            madvise((void *) start, end - start, MADV_WILLNEED);
         }
+#endif
     }
     
-    static void block_soft_threshold_mcp(VectorXd &res, const VectorXd &vec, const double &penalty,
-                                         VectorXd &pen_fact, double &d,
-                                         std::vector<std::vector<int> > &grp_idx, 
-                                         const int &ngroups, VectorXi &unique_grps, VectorXi &grps,
-                                         double & gamma)
+    // one pass over the rows of X in nslices slices which
+    // computes X'WX (only if n > p), X'WY, the column sums 
+    // and the weighted column sums of squares together, so 
+    // a file-backed X is only read from disk once. X'WX is
+    // accumulated straight into its corner of XX
+    void data_pass()
     {
-        //int v_size = vec.size();
-        res.setZero();
+        const int pc = X.cols();
+        const int offset = int(intercept);
+        const bool need_gram = nobs > nvars + int(intercept);
+        const int slice_rows = (nobs + nslices - 1) / nslices;
         
-        for (int g = 0; g < ngroups; ++g) 
+        VectorXd wy = Y;
+        if (wt_len)
         {
-            double thresh_factor;
-            std::vector<int> gr_idx = grp_idx[g];
-            
-            if (unique_grps(g) == 0) // the 0 group represents unpenalized variables
-            {
-                thresh_factor = 1.0;
-            } else 
-            {
-                double ds_norm = 0.0;
-                for (std::vector<int>::size_type v = 0; v < gr_idx.size(); ++v)
-                {
-                    int c_idx = gr_idx[v];
-                    ds_norm += std::pow(vec(c_idx), 2);
-                }
-                ds_norm = std::sqrt(ds_norm);
-                // double grp_wts = sqrt(gr_idx.size());
-                double grp_wts = pen_fact(g);
-                //thresh_factor = std::max(0.0, 1.0 - penalty * grp_wts / (ds_norm) );
-                thresh_factor = soft_threshold_mcp_norm(ds_norm, penalty * grp_wts, d, gamma);
-            }
-            if (thresh_factor != 0.0)
-            {
-                for (std::vector<int>::size_type v = 0; v < gr_idx.size(); ++v)
-                {
-                    int c_idx = gr_idx[v];
-                    res(c_idx) = vec(c_idx) * thresh_factor / d;
-                }
-            }
+            wy.array() *= weights.array();
         }
-    }
-    
-    static void block_soft_threshold(VectorXd &res, const VectorXd &vec, const double &penalty,
-                                     VectorXd &pen_fact, double &d,
-                                     std::vector<std::vector<int> > &grp_idx, 
-                                     const int &ngroups, VectorXi &unique_grps, VectorXi &grps)
-    {
-        //int v_size = vec.size();
-        res.setZero();
         
-        for (int g = 0; g < ngroups; ++g) 
+        XY.setZero();
+        colsums.setZero();
+        colsq.setZero();
+        if (need_gram)
         {
-            double thresh_factor;
-            std::vector<int> gr_idx = grp_idx[g];
-            /*
-            for (int v = 0; v < v_size; ++v) 
-            {
-            if (grps(v) == unique_grps(g)) 
-            {
-            gr_idx.push_back(v);
-            }
-            }
-            */
-            if (unique_grps(g) == 0) 
-            {
-                thresh_factor = 1.0;
-            } else 
-            {
-                double ds_norm = 0.0;
-                for (std::vector<int>::size_type v = 0; v < gr_idx.size(); ++v)
-                {
-                    int c_idx = gr_idx[v];
-                    ds_norm += std::pow(vec(c_idx), 2);
-                }
-                ds_norm = std::sqrt(ds_norm);
-                // double grp_wts = sqrt(gr_idx.size());
-                double grp_wts = pen_fact(g);
-                thresh_factor = std::max(0.0, 1.0 - penalty * grp_wts / (ds_norm) );
-            }
-            if (thresh_factor != 0.0)
-            {
-                for (std::vector<int>::size_type v = 0; v < gr_idx.size(); ++v)
-                {
-                    int c_idx = gr_idx[v];
-                    res(c_idx) = vec(c_idx) * thresh_factor / d;
-                }
-            }
+            XX.setZero();
         }
-    }
-    
-    
-    MatrixXd XtX() const {
-        if (nslices <= 1)
-        {
-            return MatrixXd(XXdimCalc, XXdimCalc).setZero().selfadjointView<Lower>().
-            rankUpdate(X.adjoint());
-        } else 
-        {
-            MatrixXd XXtmp(XXdimCalc, XXdimCalc);
-            XXtmp.setZero();
-            
-            int numrowscurfirst = std::floor(double(nobs) / double(nslices) );
-            
-        //#pragma omp parallel
+        
+        prefetch_rows(0, slice_rows);
+        
+        for (int r0 = 0; r0 < nobs; r0 += slice_rows)
         {
-            MatrixXd XXtmp_private(XXdimCalc, XXdimCalc);
-            XXtmp_private.setZero();
+            const int nr = std::min(slice_rows, nobs - r0);
             
-            // break up computation of X'X into 
-            // X'X = X_1'X_1 + ... + X_ncores'X_ncores
-            //#pragma omp for schedule(static) nowait
-            for (int ff = 0; ff < nslices; ++ff)
+            if (r0 + nr < nobs)
             {
-                
-                if (ff + 1 == nslices)
-                {
-                    int numrowscur = nobs - (nslices - 1) * std::floor(double(nobs) / double(nslices));
-                    XXtmp_private += MatrixXd(XXdimCalc, XXdimCalc).setZero().selfadjointView<Lower>().
-                    rankUpdate(X.bottomRows(numrowscur).adjoint());
-                } else 
-                {
-                    XXtmp_private += MatrixXd(XXdimCalc, XXdimCalc).setZero().selfadjointView<Lower>().
-                    rankUpdate(X.middleRows(ff * numrowscurfirst, numrowscurfirst).adjoint());
-                }
+                prefetch_rows(r0 + nr, std::min(slice_rows, nobs - r0 - nr));
             }
-            //#pragma omp critical
+            
+            if (need_gram)
             {
-                XXtmp += XXtmp_private; 
+                Linalg::gram_tiled_update(XX.bottomRightCorner(pc, pc), X.middleRows(r0, nr), 
+                                          (wt_len ? weights.data() + r0 : (const double*) NULL), 
+                                          ncores);
             }
             
-        }
-        return XXtmp;
-        }
-    }
-    
-    MatrixXd XXt() const {
-        return MatrixXd(XXdimCalc, XXdimCalc).setZero().selfadjointView<Lower>().
-        rankUpdate(X);
-    }
-    
-    MatrixXd XtWX() const {
-        
-        if (nslices <= 1)
-        {
-            return MatrixXd(XXdimCalc, XXdimCalc).setZero().selfadjointView<Lower>().
-            rankUpdate(X.adjoint() * (weights.array().sqrt().matrix()).asDiagonal() );
-        } else 
-        {
-            MatrixXd XXtmp(XXdimCalc, XXdimCalc);
-            XXtmp.setZero();
-            
-            int numrowscurfirst = std::floor(double(nobs) / double(nslices));
-            
-            //#pragma omp parallel
+            #pragma omp parallel for schedule(static) num_threads(ncores)
+            for (int j = 0; j < pc; ++j)
             {
-                MatrixXd XXtmp_private(XXdimCalc, XXdimCalc);
-                XXtmp_private.setZero();
-                
-                // break up computation of X'X into 
-                // X'X = X_1'X_1 + ... + X_ncores'X_ncores
-                
-                //#pragma omp for schedule(static) nowait
-                for (int ff = 0; ff < nslices; ++ff)
+                XY(j + offset) += X.col(j).segment(r0, nr).template cast<double>().dot(wy.segment(r0, nr));
+                colsums(j)     += X.col(j).segment(r0, nr).template cast<double>().sum();
+                if (wt_len)
                 {
-                    
-                    if (ff + 1 == nslices)
-                    {
-                        int numrowscur = nobs - (nslices - 1) * std::floor(double(nobs) / double(nslices));
-                        XXtmp_private += MatrixXd(XXdimCalc, XXdimCalc).setZero().selfadjointView<Lower>().
-                        rankUpdate(X.bottomRows(numrowscur).adjoint() * 
-                        (weights.tail(numrowscur).array().sqrt().matrix()).asDiagonal());
-                    } else 
-                    {
-                        XXtmp_private += MatrixXd(XXdimCalc, XXdimCalc).setZero().selfadjointView<Lower>().
-                        rankUpdate(X.middleRows(ff * numrowscurfirst, numrowscurfirst).adjoint() * 
-                        (weights.segment(ff * numrowscurfirst, numrowscurfirst).array().sqrt().matrix()).asDiagonal());
-                    }
-                }
-                //#pragma omp critical
+                    colsq(j) += (X.col(j).segment(r0, nr).template cast<double>().array().square() * 
+                                 weights.segment(r0, nr).array()).sum();
+                } else 
                 {
-                    XXtmp += XXtmp_private; 
+                    colsq(j) += X.col(j).segment(r0, nr).template cast<double>().squaredNorm();
                 }
-                
             }
-            return XXtmp;
         }
     }
     
-    MatrixXd XWXt() const {
-        return MatrixXd(XXdimCalc, XXdimCalc).setZero().selfadjointView<Lower>().
-        rankUpdate( (weights.array().sqrt().matrix()).asDiagonal() * X );
-    }
-    /*
-    MatrixXd XXt() const {
-        return MatrixXd(nobs, nobs).setZero().selfadjointView<Lower>().
-        rankUpdate(X);
-    }
-    
-    MatrixXd XWXt() const {
-        return MatrixXd(nobs, nobs).setZero().selfadjointView<Lower>().
-        rankUpdate( (weights.array().sqrt().matrix()).asDiagonal() * X );
-    }
-     */
-    
     void get_group_indexes()
     {
         // if the group is any group penalty
@@ -437,20 +189,7 @@ protected:
         {
             found_grp_idx = true;
             
-            grp_idx.reserve(ngroups);
-            for (int g = 0; g < ngroups; ++g) 
-            {
-                // find all variables in group number g
-                std::vector<int> idx_tmp;
-                for (int v = 0; v < nvars; ++v) 
-                {
-                    if (groups(v) == unique_groups(g)) 
-                    {
-                        idx_tmp.push_back(v);
-                    }
-                }
-                grp_idx[g] = idx_tmp;
-            }
+            grp_idx.build(groups, unique_groups, nvars);
             // if group weights were not specified,
             // then set the group weight for each
             // group to be the sqrt of the size of the
@@ -460,12 +199,22 @@ protected:
                 group_weights.resize(ngroups);
                 for (int g = 0; g < ngroups; ++g) 
                 {
-                    group_weights(g) = std::sqrt(double(grp_idx[g].size()));
+                    group_weights(g) = std::sqrt(double(grp_idx.size(g)));
                 }
             }
         }
     }
     
+    // standardizes the X'WX that data_pass() left in XX, in place
+    void scale_gram()
+    {
+        Eigen::Block<MatrixXd> gram = XX.bottomRightCorner(nvars, nvars);
+        for (int j = 0; j < nvars; ++j)
+        {
+            gram.col(j).array() *= colsq_inv.array() * colsq_inv(j);
+        }
+    }
+    
     void compute_XtX_d_update_A()
     {
         
@@ -480,10 +229,7 @@ protected:
                     if (standardize)
                     {
                         colsums.array() *= colsq_inv.array();
-                        XX.bottomRightCorner(nvars, nvars) = colsq_inv.asDiagonal() * XtWX() * colsq_inv.asDiagonal();
-                    } else 
-                    {
-                        XX.bottomRightCorner(nvars, nvars) = XtWX();
+                        scale_gram();
                     }
                     // colsums should already be standardized if standardize = TRUE
                     XX.block(0,1,1,nvars) = colsums;
@@ -493,10 +239,7 @@ protected:
                 {
                     if (standardize)
                     {
-                        XX = colsq_inv.asDiagonal() * XtWX() * colsq_inv.asDiagonal();
-                    } else 
-                    {
-                        XX = XtWX();
+                        scale_gram();
                     }
                 }
             } else 
@@ -514,10 +257,7 @@ protected:
                     if (standardize)
                     {
                         colsums.array() *= colsq_inv.array();
-                        XX.bottomRightCorner(nvars, nvars) = colsq_inv.asDiagonal() * XtX() * colsq_inv.asDiagonal();
-                    } else 
-                    {
-                        XX.bottomRightCorner(nvars, nvars) = XtX();
+                        scale_gram();
                     }
                     // colsums should already be standardized if standardize = TRUE
                     XX.block(0,1,1,nvars) = colsums;
@@ -527,10 +267,7 @@ protected:
                 {
                     if (standardize)
                     {
-                        XX = colsq_inv.asDiagonal() * XtX() * colsq_inv.asDiagonal();
-                    } else 
-                    {
-                        XX = XtX();
+                        scale_gram();
                     }
                 }
             } else 
@@ -557,139 +294,80 @@ protected:
         eigs.compute(10000, 1e-10);
         Vector eigenvals = eigs.eigenvalues();
         d = eigenvals[0] * 1.005; // multiply by an increasing factor to be safe
-        
-        if (nobs > nvars)
-        {
-            A = -XX;
-            A.diagonal().array() += d;
-        }
     }
     
     void next_u(Vector &res)
     {
         if (nobs > nvars + int(intercept))
         {
-            res.noalias() = A * beta_prev + XY;
+            sparse_A_prod(res, XX, beta_prev, XY);
         } else 
         {
-            if (wt_len)
+            // X is read one column at a time so that columns of 
+            // another type are converted without a copy of X. the
+            // intercept, if any, is the first coefficient
+            const int add = int(intercept);
+            VectorXd resid = Y;
+            if (intercept)
             {
-                res.noalias() = X.adjoint() * ((Y - X * beta_prev).array() * weights.array().square()).matrix() / double(nobs) + d * beta_prev;
-            } else
+                resid.array() -= beta_prev(0);
+            }
+            for (int j = 0; j < nvars; ++j)
             {
-                res.noalias() = X.adjoint() * (Y - X * beta_prev) / double(nobs) + d * beta_prev;
+                if (beta_prev(j + add) != 0.0)
+                {
+                    resid.noalias() -= X.col(j).template cast<double>() * beta_prev(j + add);
+                }
             }
-        }
-    }
-    
-    void next_beta(Vector &res)
-    {
-        if (penalty == "lasso")
-        {
-            soft_threshold(beta, u, lambda, penalty_factor, d);
-        } else if (penalty == "ols")
-        {
-            beta = u / d;
-        } else if (penalty == "elastic.net")
-        {
-            double denom = d + (1.0 - alpha) * lambda;
-            double lam = lambda * alpha;
-            
-            soft_threshold(beta, u, lam, penalty_factor, denom);
-        } else if (penalty == "scad") 
-        {
-            soft_threshold_scad(beta, u, lambda, penalty_factor, d, gamma);
-            
-        } else if (penalty == "scad.net") 
-        {
-            double denom = d + (1.0 - alpha) * lambda;
-            double lam = lambda * alpha;
             
-            if (alpha == 0)
+            if (wt_len)
             {
-                lam   = 0;
-                denom = d + lambda;
+                resid.array() *= weights.array().square();
             }
             
-            soft_threshold_scad(beta, u, lam, penalty_factor, denom, gamma);
-            
-        } else if (penalty == "mcp") 
-        {
-            soft_threshold_mcp(beta, u, lambda, penalty_factor, d, gamma);
-        } else if (penalty == "mcp.net") 
-        {
-            double denom = d + (1.0 - alpha) * lambda;
-            double lam = lambda * alpha;
-            
-            soft_threshold_mcp(beta, u, lam, penalty_factor, denom, gamma);
-            
-        } else if (penalty == "grp.lasso")
-        {
-            block_soft_threshold(beta, u, lambda, group_weights,
-                                 d, grp_idx, ngroups, 
-                                 unique_groups, groups);
-        } else if (penalty == "grp.lasso.net")
-        {
-            double denom = d + (1.0 - alpha) * lambda;
-            double lam = lambda * alpha;
-            
-            block_soft_threshold(beta, u, lam, group_weights,
-                                 denom, grp_idx, ngroups, 
-                                 unique_groups, groups);
-            
-        } else if (penalty == "grp.mcp")
-        {
-            block_soft_threshold_mcp(beta, u, lambda, group_weights,
-                                     d, grp_idx, ngroups, 
-                                     unique_groups, groups, gamma);
-        } else if (penalty == "grp.scad")
-        {
-            block_soft_threshold_scad(beta, u, lambda, group_weights,
-                                      d, grp_idx, ngroups, 
-                                      unique_groups, groups, gamma);
-        } else if (penalty == "grp.mcp.net")
-        {
-            double denom = d + (1.0 - alpha) * lambda;
-            double lam = lambda * alpha;
-            
+            if (intercept)
+            {
+                res(0) = resid.sum();
+            }
             
-            block_soft_threshold_mcp(beta, u, lam, group_weights,
-                                     denom, grp_idx, ngroups, 
-                                     unique_groups, groups, gamma);
-        } else if (penalty == "grp.scad.net")
-        {
-            double denom = d + (1.0 - alpha) * lambda;
-            double lam = lambda * alpha;
+            #pragma omp parallel for schedule(static) num_threads(ncores)
+            for (int j = 0; j < nvars; ++j)
+            {
+                res(j + add) = X.col(j).template cast<double>().dot(resid);
+            }
             
-            block_soft_threshold_scad(beta, u, lam, group_weights,
-                                      denom, grp_idx, ngroups, 
-                                      unique_groups, groups, gamma);
-        } else if (penalty == "sparse.grp.lasso")
+            res /= double(nobs);
+            res += d * beta_prev;
+        }
+    }
+    
+    double xy_dot(const VectorXd &b) const
+    {
+        return b.dot(XY);
+    }
+    
+    bool next_u_delta(Vector &res, const Vector &delta)
+    {
+        if (nobs > nvars + int(intercept))
         {
-            double lam_grp = (1.0 - tau) * lambda;
-            double lam_l1  = tau * lambda;
-            
-            double fact = 1.0;
-            
-            // first apply soft thresholding
-            // but don't divide by d
-            soft_threshold(beta, u, lam_l1, penalty_factor, fact);
-            
-            VectorXd beta_tmp = beta;
-            
-            // then apply block soft thresholding
-            block_soft_threshold(beta, beta_tmp, lam_grp, 
-                                 group_weights,
-                                 d, grp_idx, ngroups, 
-                                 unique_groups, groups);
+            add_sparse_A_prod(res, XX, delta);
+            return true;
         }
-        
-        
+        return false;
     }
     
+    bool sub_gram(MatrixXd &xx_sub, VectorXd &xy_sub, const std::vector<int> &idx)
+    {
+        if (nobs > nvars + int(intercept))
+        {
+            sub_gram_from_XX(xx_sub, xy_sub, XX, XY, idx);
+            return true;
+        }
+        return false;
+    }
     
     public:
-        oemBig(const Map<MatrixXd> &X_, 
+        oemBig(const MapXMat &X_, 
                ConstGenericVector &Y_,
                const VectorXd &weights_,
                const VectorXi &groups_,
@@ -699,33 +377,32 @@ protected:
                bool &intercept_,
                bool &standardize_,
                const double tol_ = 1e-6,
-               const double gigs_ = 4.0) :
+               const double gigs_ = 4.0,
+               const int ncores_ = 1) :
         oemBase<Eigen::VectorXd>(X_.rows(), 
                                  X_.cols(),
-                                 unique_groups_.size(),
+                                 groups_,
+                                 unique_groups_,
+                                 group_weights_,
+                                 penalty_factor_,
                                  intercept_, 
                                  standardize_,
                                  tol_),
                                  X(X_.data(), X_.rows(), X_.cols()),
                                  Y(Y_.data(), Y_.size()),
                                  weights(weights_),
-                                 groups(groups_),
-                                 unique_groups(unique_groups_),
-                                 penalty_factor(penalty_factor_),
-                                 group_weights(group_weights_),
                                  penalty_factor_size(penalty_factor_.size()),
                                  XXdim( std::min(X_.cols() + int(intercept_) , X_.rows()) ),
                                  XXdimCalc( std::min(X_.cols(), X_.rows()) ),
                                  XY(X_.cols() + int(intercept_) ), // add extra space if intercept
                                  XX(XXdim, XXdim),                 // add extra space if intercept
-                                 default_group_weights(bool(group_weights_.size() < 1)), // compute default weights if none given
-                                                                                    grp_idx(unique_groups_.size()),
+                                 ncores(std::max(ncores_, 1)),
                                  gigs(gigs_),
                                  colsums(X_.cols()),
                                  colsq(X_.cols()),
                                  colsq_inv(X_.cols())
         
-                                                                                    {}
+        {}
         
         
         void init_oem()
@@ -735,78 +412,26 @@ protected:
             
             found_grp_idx = false;
             
-            double xgigs = 8.0 * double(nobs) * double(pc) / std::pow(10.0, 9);
+            // size of X as stored, since rows are only converted 
+            // to double a panel at a time as they are read
+            double xgigs = double(sizeof(XScalar)) * double(nobs) * double(pc) / std::pow(10.0, 9);
             
             // calculate number of rows per slice
-            nslices = std::ceil(xgigs / gigs);
+            nslices = std::max(int(std::ceil(xgigs / gigs)), 1);
+            
+            // X'WX, X'WY, column sums and column sums of 
+            // squares from one pass over the rows of X
+            data_pass();
             
             if (standardize)
             {
-                if (wt_len)
-                {
-                    // colsq = ( weights.asDiagonal() * (X.array().square().matrix()) ).colwise().sum() / (nobs - 1);
-                    // don't want to access all of X at once
-                    for (int i = 0; i < pc; ++i)
-                    {
-                        colsq(i) = (X.col(i).array().square() * weights.array()).sum() / (nobs - 1);
-                    }
-                } else 
-                {
-                    // colsq = X.array().square().matrix().colwise().sum() / (nobs - 1);
-                    // don't want to access all of X at once
-                    for (int i = 0; i < pc; ++i)
-                    {
-                        colsq(i) = X.col(i).array().square().sum() / (double(nobs) - 1.0);
-                    }
-                }
+                colsq /= (double(nobs) - 1.0);
                 colsq_inv = 1.0 / colsq.array().sqrt();
             }
             
-            
-            
-            if (wt_len)
+            if (intercept)
             {
-                if (intercept)
-                {
-                    // XY.tail(nvars) = X.transpose() * (Y.array() * weights.array()).matrix();
-                    // don't want to access all of X at once
-                    for (int i = 0; i < pc; ++i)
-                    {
-                        XY(i + 1) = X.col(i).dot((Y.array() * weights.array()).matrix());
-                    }
-                    
-                    XY(0) = (weights.array().sqrt() * Y.array()).sum();
-                } else
-                {
-                    // XY.noalias() = X.transpose() * (Y.array() * weights.array()).matrix();
-                    // don't want to access all of X at once
-                    for (int i = 0; i < pc; ++i)
-                    {
-                        XY(i) = X.col(i).dot((Y.array() * weights.array()).matrix());
-                    }
-                    
-                }
-            } else
-            {
-                if (intercept)
-                {
-                    // XY.tail(nvars) = X.transpose() * Y;
-                    // don't want to access all of X at once
-                    for (int i = 0; i < pc; ++i)
-                    {
-                        XY(i + 1) = X.col(i).dot(Y);
-                    }
-                    
-                    XY(0) = Y.sum();
-                } else 
-                {
-                    // XY.noalias() = X.transpose() * Y;
-                    // don't want to access all of X at once
-                    for (int i = 0; i < pc; ++i)
-                    {
-                        XY(i) = X.col(i).dot(Y);
-                    }
-                }
+                XY(0) = wt_len ? (weights.array().sqrt() * Y.array()).sum() : Y.sum();
             }
             
             if (standardize)
@@ -822,17 +447,18 @@ protected:
             
             XY /= nobs;
             
+            // Y'Y for the duality gap. when p >= n with weights
+            // the iterations use squared weights, which X'Y does not
+            if (!(wt_len && nobs <= nvars + int(intercept)))
+            {
+                yty = (wt_len ? (Y.array().square() * weights.array()).sum() : Y.squaredNorm()) / nobs;
+            }
+            
             if (intercept) 
             {
                 u.resize(nvars + 1);
                 beta.resize(nvars + 1);
                 beta_prev.resize(nvars + 1);
-                // colsums = X.colwise().sum();
-                // don't want to access all of X at once
-                for (int i = 0; i < pc; ++i)
-                {
-                    colsums(i) = X.col(i).sum();
-                }
             }
             
             // compute XtX or XXt (depending on if n > p or not)
@@ -845,8 +471,7 @@ protected:
             lambda0 = XY.cwiseAbs().maxCoeff();
             return lambda0; 
         }
-        double get_d() { return d; }
-        
+            
         // init() is a cold start for the first lambda
         void init(double lambda_, std::string penalty_,
                   double alpha_, double gamma_, double tau_)
@@ -854,7 +479,7 @@ protected:
             beta.setZero();
             
             lambda = lambda_;
-            penalty = penalty_;
+            set_penalty(penalty_);
             
             alpha = alpha_;
             gamma = gamma_;
@@ -895,17 +520,29 @@ protected:
             }
         }
         
+        // when X'X is held this is computed from X'X, X'Y and y'y,
+        // so the memory-mapped X is not read again
         virtual double get_loss()
         {
+            if (nobs > nvars + int(intercept) && yty >= 0.0)
+            {
+                return gram_loss(XX, XY, beta);
+            }
+            
             double loss;
             VectorXd xbeta(nobs);
             int pc = X.cols();
             
-            xbeta.setZero();
+            // X is on the original scale, as are the 
+            // coefficients of get_beta()
+            VectorXd beta_orig = get_beta();
+            const int add = int(intercept);
+            
+            xbeta.setConstant(intercept ? beta_orig(0) : 0.0);
             
             for (int i = 0; i < pc; ++i)
             {
-                xbeta.array() += (X.col(i) * beta).array();
+                xbeta += X.col(i).template cast<double>() * beta_orig(i + add);
             }
             
             if (wt_len)
@@ -920,5 +557,103 @@ protected:
         };
 
 
+// whether a big.matrix of element type T holds an NA. bigmemory 
+// stores NA in char, short and int matrices as the smallest value 
+// of the type, and in float matrices as FLT_MIN. casting those to
+// double would fit them as data, so they are looked for up front
+template <typename T>
+bool big_has_na(const T *x, const int n, const int p, const T na, int ncores)
+{
+    bool found = false;
+    
+    #pragma omp parallel for schedule(static) num_threads(ncores) reduction(||:found)
+    for (int j = 0; j < p; ++j)
+    {
+        const T *col = x + (size_t) j * n;
+        for (int i = 0; i < n; ++i)
+        {
+            // x != x catches float NaN as well
+            if (col[i] == na || col[i] != col[i])
+            {
+                found = true;
+                break;
+            }
+        }
+    }
+    return found;
+}
+
+
+// gaussian solver for a big.matrix of any of the element types 
+// bigmemory provides. the data are mapped with their own type, 
+// so nothing is converted or copied up front
+inline oemBase<Eigen::VectorXd> *new_oem_big(BigMatrix *bm,
+                                             const Map<VectorXd> &Y,
+                                             const VectorXd &weights,
+                                             const VectorXi &groups,
+                                             const VectorXi &unique_groups,
+                                             VectorXd &group_weights,
+                                             VectorXd &penalty_factor,
+                                             bool &intercept,
+                                             bool &standardize,
+                                             const double tol,
+                                             const double gigs,
+                                             const int ncores)
+{
+    const int n = bm->nrow();
+    const int p = bm->ncol();
+    
+    bool has_na = false;
+    switch (bm->matrix_type())
+    {
+    case 1:
+        has_na = big_has_na((const char *) bm->matrix(), n, p, (char) CHAR_MIN, ncores);
+        break;
+    case 2:
+        has_na = big_has_na((const short *) bm->matrix(), n, p, (short) SHRT_MIN, ncores);
+        break;
+    case 4:
+        has_na = big_has_na((const int *) bm->matrix(), n, p, (int) INT_MIN, ncores);
+        break;
+    case 6:
+        has_na = big_has_na((const float *) bm->matrix(), n, p, (float) FLT_MIN, ncores);
+        break;
+    }
+    if (has_na)
+    {
+        throw std::invalid_argument("x has missing values");
+    }
+    
+    switch (bm->matrix_type())
+    {
+    case 1:
+        return new oemBig<char>(Map<const Eigen::Matrix<char, Eigen::Dynamic, Eigen::Dynamic> >((const char *) bm->matrix(), n, p),
+                                Y, weights, groups, unique_groups, group_weights, penalty_factor,
+                                intercept, standardize, tol, gigs, ncores);
+    case 3:
+        return new oemBig<unsigned char>(Map<const Eigen::Matrix<unsigned char, Eigen::Dynamic, Eigen::Dynamic> >((const unsigned char *) bm->matrix(), n, p),
+                                         Y, weights, groups, unique_groups, group_weights, penalty_factor,
+                                         intercept, standardize, tol, gigs, ncores);
+    case 2:
+        return new oemBig<short>(Map<const Eigen::Matrix<short, Eigen::Dynamic, Eigen::Dynamic> >((const short *) bm->matrix(), n, p),
+                                 Y, weights, groups, unique_groups, group_weights, penalty_factor,
+                                 intercept, standardize, tol, gigs, ncores);
+    case 4:
+        return new oemBig<int>(Map<const Eigen::Matrix<int, Eigen::Dynamic, Eigen::Dynamic> >((const int *) bm->matrix(), n, p),
+                               Y, weights, groups, unique_groups, group_weights, penalty_factor,
+                               intercept, standardize, tol, gigs, ncores);
+    case 6:
+        return new oemBig<float>(Map<const Eigen::Matrix<float, Eigen::Dynamic, Eigen::Dynamic> >((const float *) bm->matrix(), n, p),
+                                 Y, weights, groups, unique_groups, group_weights, penalty_factor,
+                                 intercept, standardize, tol, gigs, ncores);
+    case 8:
+        return new oemBig<double>(Map<const MatrixXd>((const double *) bm->matrix(), n, p),
+                                  Y, weights, groups, unique_groups, group_weights, penalty_factor,
+                                  intercept, standardize, tol, gigs, ncores);
+    default:
+        throw std::invalid_argument("type for provided big.matrix not available");
+    }
+}
+
 
 #endif // OEM_BIG_H
@@ -26,6 +26,11 @@ typedef Map<Eigen::MatrixXd> MapMatd;
 typedef Eigen::SparseVector<double> SpVec;
 typedef Eigen::SparseMatrix<double> SpMat;
 
+// the largest column |mean| / sd for which the centering 
+// is applied to X'X rather than to a copy of X. the centered
+// X'X then keeps a relative accuracy of about 1e-10
+static const double max_gram_center_ratio = 1e3;
+
 
 RcppExport SEXP oem_fit_dense(SEXP x_, 
                               SEXP y_, 
@@ -58,12 +63,10 @@ RcppExport SEXP oem_fit_dense(SEXP x_,
     const VectorXi groups(as<VectorXi>(groups_));
     const VectorXi unique_groups(as<VectorXi>(unique_groups_));
     
-    MatrixXd X(n, p);
     VectorXd Y(n);
     
     
     // Copy data 
-    std::copy(xx.begin(), xx.end(), X.data());
     std::copy(yy.begin(), yy.end(), Y.data());
     
 
@@ -92,6 +95,10 @@ RcppExport SEXP oem_fit_dense(SEXP x_,
     const int maxit        = as<int>(opts["maxit"]);
     int ncores             = as<int>(opts["ncores"]);
     const double tol       = as<double>(opts["tol"]);
+    const int aa_depth     = as<int>(opts["anderson_depth"]);
+    const bool screen      = as<bool>(opts["screen"]);
+    const int gap_freq     = as<int>(opts["gap_freq"]);
+    std::vector<std::string> stop_rule(as< std::vector<std::string> >(opts["stop.rule"]));
     const double alpha     = as<double>(alpha_);
     const double gamma     = as<double>(gamma_);
     const double tau       = as<double>(tau_);
@@ -100,6 +107,9 @@ RcppExport SEXP oem_fit_dense(SEXP x_,
     bool intercept_bin     = intercept;
     bool compute_loss      = as<bool>(compute_loss_);
     const bool accelerate  = as<double>(opts["accelerate"]);
+    const bool mixed_prec  = as<bool>(opts["mixed_precision"]);
+    const bool polish      = as<bool>(opts["polish"]);
+    const bool par_path    = as<bool>(opts["parallel_path"]);
     
     
     CharacterVector family(as<CharacterVector>(family_));
@@ -107,11 +117,8 @@ RcppExport SEXP oem_fit_dense(SEXP x_,
     VectorXd penalty_factor(as<VectorXd>(penalty_factor_));
     
     
-    // take all threads but one
-    if (ncores < 1)
-    {
-        ncores = std::max(omp_get_num_threads() - 1, 1);
-    }
+    // ncores < 1 takes all threads but one
+    ncores = resolve_ncores(ncores);
     
     omp_set_num_threads(ncores);
     
@@ -148,21 +155,57 @@ RcppExport SEXP oem_fit_dense(SEXP x_,
         }
     }
     
+    // X is read in place from R's memory when its standardization
+    // can be applied to X'X and X'Y instead. otherwise it is 
+    // copied so that it can be standardized in place
+    bool map_x = (family(0) == "gaussian" && n > p && weights.size() == 0);
+    
     DataStd<double> datstd(n, p + add, standardize, intercept);
-    datstd.standardize(X, Y, weights);
+    if (map_x)
+    {
+        // centering X'X cancels badly for columns whose mean is
+        // large next to their spread, so X is copied and 
+        // standardized itself when any column is like that
+        const Map<const MatrixXd> X_in(xx.begin(), n, p);
+        VectorXd Y_std = Y;
+        datstd.standardize_stats(X_in, Y_std);
+        map_x = (datstd.max_mean_sd_ratio(X_in) <= max_gram_center_ratio);
+        if (map_x)
+        {
+            Y = Y_std;
+        }
+    }
+    
+    MatrixXd X_copy;
+    if (!map_x)
+    {
+        X_copy.resize(n, p);
+        std::copy(xx.begin(), xx.end(), X_copy.data());
+        datstd.standardize(X_copy, Y, weights);
+    }
+    
+    const Map<const MatrixXd> X(map_x ? xx.begin() : X_copy.data(), n, p);
     
     
     // initialize pointers 
     oemBase<Eigen::VectorXd> *solver = NULL; // solver doesn't point to anything yet
+    oemDense *dense_solver = NULL;           // same solver, for fitting path segments
     
     
     // initialize classes
     if (family(0) == "gaussian")
     {
-        solver = new oemDense(X, Y, weights, groups, unique_groups, 
-                              group_weights, penalty_factor, 
-                              intercept, standardize, 
-                              ncores, tol, accelerate);
+        dense_solver = new oemDense(X, Y, weights, groups, unique_groups, 
+                                    group_weights, penalty_factor, 
+                                    intercept, standardize, 
+                                    ncores, tol, accelerate,
+                                    mixed_prec, polish);
+        solver = dense_solver;
+        
+        if (map_x)
+        {
+            dense_solver->set_column_std(datstd.get_meanX(), datstd.get_scaleX());
+        }
     } else if (family(0) == "binomial")
     {
         throw std::invalid_argument("binomial not available for oem_fit_dense, use oem_fit_logistic_dense");
@@ -170,6 +213,18 @@ RcppExport SEXP oem_fit_dense(SEXP x_,
     }
     
     
+    // safeguarded Anderson acceleration of the oem iterations
+    solver->set_anderson(aa_depth);
+    
+    // strong rule screening along the lambda path
+    solver->set_screen(screen);
+    
+    // check convergence with the duality gap where it is available
+    if (stop_rule[0] == "duality.gap")
+    {
+        solver->set_gap_freq(gap_freq);
+    }
+    
     solver->init_oem();
     
     double lmax = 0.0;
@@ -203,98 +258,302 @@ RcppExport SEXP oem_fit_dense(SEXP x_,
     
     std::string elasticnettxt(".net");
     
-    for (unsigned int pp = 0; pp < penalty.size(); pp++)
+    // with several penalties, fit them concurrently. each 
+    // thread has its own solver state for one penalty, 
+    // reading the X'X, X'Y and d of dense_solver
+    const int npen = penalty.size();
+    const bool par_pen = (npen > 1 && ncores > 1 && dense_solver != NULL &&
+                          dense_solver->can_share_gram());
+    
+    if (par_pen)
     {
-        if (penalty[pp] == "ols")
+        std::vector<MatrixXd> beta_pen(npen, MatrixXd(p + 1, nlambda));
+        std::vector<VectorXd> loss_pen(npen);
+        std::vector<VectorXd> lambda_pen(npen);
+        std::vector<std::vector<int> > niter_pen(npen, std::vector<int>(nlambda));
+        
+        for (int pp = 0; pp < npen; pp++)
         {
-            nlambda = 1L;
+            if (provided_lambda)
+            {
+                lambda_pen[pp] = lambda[pp];
+            } else if (penalty[pp].find(elasticnettxt) != std::string::npos)
+            {
+                lambda_pen[pp] = (lambda_base.array() / alpha).matrix();
+            } else
+            {
+                lambda_pen[pp] = lambda_base;
+            }
         }
         
-        bool is_net_pen = penalty[pp].find(elasticnettxt) != std::string::npos;
+        // errors can't leave the parallel region, so 
+        // they are collected and thrown after it
+        std::string pen_error;
         
-        if (provided_lambda)
+        #pragma omp parallel for schedule(dynamic, 1) num_threads(std::min(ncores, npen))
+        for (int pp = 0; pp < npen; pp++)
         {
-            lambda_tmp = lambda[pp];
-        } else 
-        {
-            if (is_net_pen)
+            const int nlambda_pen = (penalty[pp] == "ols") ? 1 : nlambda;
+            
+            oemXTX *solver_pen = NULL;
+            
+            try
             {
-                lambda_tmp = (lambda_base.array() / alpha).matrix(); // * n; // 
-            } else
+                solver_pen = dense_solver->gram_solver();
+                
+                loss_pen[pp].setConstant(nlambda_pen, 1e99);
+                
+                for (int i = 0; i < nlambda_pen; i++)
+                {
+                    double ilambda_pen = lambda_pen[pp](i) / datstd.get_scaleY();
+                    
+                    if (i == 0)
+                        solver_pen->init(ilambda_pen, penalty[pp], alpha, gamma, tau);
+                    else
+                        solver_pen->init_warm(ilambda_pen);
+                    
+                    niter_pen[pp][i] = solver_pen->solve(maxit);
+                    VectorXd res = solver_pen->get_beta();
+                    
+                    if (compute_loss)
+                    {
+                        loss_pen[pp](i) = dense_solver->get_loss(res);
+                    }
+                    
+                    double beta0 = 0.0;
+                    datstd.recover(beta0, res);
+                    beta_pen[pp](0,i) = beta0;
+                    beta_pen[pp].block(1, i, p, 1) = res;
+                }
+            } catch (std::exception &e)
             {
-                lambda_tmp = lambda_base; // * n; // 
+                #pragma omp critical
+                pen_error = e.what();
             }
+            
+            delete solver_pen;
         }
         
-        VectorXd loss(nlambda);
-        loss.fill(1e99);
+        if (!pen_error.empty())
+        {
+            delete solver;
+            throw std::invalid_argument(pen_error);
+        }
         
-        for(int i = 0; i < nlambda; i++)
+        for (int pp = 0; pp < npen; pp++)
         {
+            lambda[pp] = lambda_pen[pp];
             
-            if (i % 3 == 0)
+            if (penalty[pp] == "ols")
             {
-                Rcpp::checkUserInterrupt();
+                beta_list(pp) = beta_pen[pp].col(0);
+                iter_list(pp) = niter_pen[pp][0];
+                loss_list(pp) = loss_pen[pp](0);
+            } else 
+            {
+                beta_list(pp) = beta_pen[pp];
+                iter_list(pp) = wrap(niter_pen[pp]);
+                loss_list(pp) = loss_pen[pp];
             }
+        }
+    } else
+    {
+        for (unsigned int pp = 0; pp < penalty.size(); pp++)
+        {
+            if (penalty[pp] == "ols")
+            {
+                nlambda = 1L;
+            }
+        
+            bool is_net_pen = penalty[pp].find(elasticnettxt) != std::string::npos;
+        
+            if (provided_lambda)
+            {
+                lambda_tmp = lambda[pp];
+            } else 
+            {
+                if (is_net_pen)
+                {
+                    lambda_tmp = (lambda_base.array() / alpha).matrix(); // * n; // 
+                } else
+                {
+                    lambda_tmp = lambda_base; // * n; // 
+                }
+            }
+        
+            VectorXd loss(nlambda);
+            loss.fill(1e99);
+        
+            // split the path into contiguous segments, one per 
+            // thread, when the solvers can share X'X. mcp and scad
+            // solutions depend on the warm starts, so their paths
+            // are always fit in order
+            int nseg = 1;
+            if (par_path && dense_solver != NULL && dense_solver->can_share_gram() &&
+                oemBase<Eigen::VectorXd>::convex_penalty(penalty[pp]))
+            {
+                nseg = std::min(ncores, nlambda / 2);
+            }
+        
+            if (nseg > 1)
+            {
+                // first index of each segment
+                std::vector<int> seg_start(nseg + 1);
+                for (int t = 0; t <= nseg; ++t)
+                {
+                    seg_start[t] = (t * nlambda) / nseg;
+                }
             
-            
-            ilambda = lambda_tmp(i) / datstd.get_scaleY();
+                // coarse pass over the first lambda of each 
+                // segment to seed the segments with warm starts
+                std::vector<VectorXd> seg_beta(nseg);
+                for (int t = 0; t < nseg; ++t)
+                {
+                    Rcpp::checkUserInterrupt();
+                
+                    ilambda = lambda_tmp(seg_start[t]) / datstd.get_scaleY();
+                
+                    if (t == 0)
+                        solver->init(ilambda, penalty[pp], alpha, gamma, tau);
+                    else
+                        solver->init_warm(ilambda);
                 
-            if(i == 0)
-                solver->init(ilambda, penalty[pp], alpha, gamma, tau);
-            else
-                solver->init_warm(ilambda);
+                    solver->solve(maxit);
+                    seg_beta[t] = solver->get_beta();
+                }
             
-            niter[i] = solver->solve(maxit);
-            VectorXd res = solver->get_beta();
+                std::vector<int> seg_niter(nlambda);
+                
+                // errors can't leave the parallel region, so 
+                // they are collected and thrown after it
+                std::string seg_error;
             
-            double beta0 = 0.0;
-            datstd.recover(beta0, res);
-            beta(0,i) = beta0;
-            beta.block(1, i, p, 1) = res;
+                // each segment has its own solver state, reading
+                // the X'X and X'Y of dense_solver
+                #pragma omp parallel for schedule(static, 1) num_threads(nseg)
+                for (int t = 0; t < nseg; ++t)
+                {
+                    oemXTX *solver_seg = NULL;
+                    
+                    try
+                    {
+                        solver_seg = dense_solver->gram_solver();
+                
+                        for (int i = seg_start[t]; i < seg_start[t + 1]; ++i)
+                        {
+                            double ilambda_seg = lambda_tmp(i) / datstd.get_scaleY();
+                    
+                            if (i == seg_start[t])
+                            {
+                                solver_seg->init(ilambda_seg, penalty[pp], alpha, gamma, tau);
+                                solver_seg->warm_start(seg_beta[t]);
+                            } else
+                            {
+                                solver_seg->init_warm(ilambda_seg);
+                            }
+                    
+                            seg_niter[i] = solver_seg->solve(maxit);
+                            VectorXd res = solver_seg->get_beta();
+                    
+                            if (compute_loss)
+                            {
+                                loss(i) = dense_solver->get_loss(res);
+                            }
+                    
+                            double beta0 = 0.0;
+                            datstd.recover(beta0, res);
+                            beta(0,i) = beta0;
+                            beta.block(1, i, p, 1) = res;
+                        }
+                    } catch (std::exception &e)
+                    {
+                        #pragma omp critical
+                        seg_error = e.what();
+                    }
+                
+                    delete solver_seg;
+                }
+                
+                if (!seg_error.empty())
+                {
+                    delete solver;
+                    throw std::invalid_argument(seg_error);
+                }
             
-            if (compute_loss)
+                for (int i = 0; i < nlambda; i++)
+                {
+                    niter[i] = seg_niter[i];
+                }
+            } else
             {
-                // get associated loss
-                loss(i) = solver->get_loss();
-            }
+                for(int i = 0; i < nlambda; i++)
+                {
+            
+                    if (i % 3 == 0)
+                    {
+                        Rcpp::checkUserInterrupt();
+                    }
             
-            // if the design matrix includes the intercept
-            // then don't back into the intercept with
-            // datastd and include it to beta directly.
-            /*
-            if (fullbetamat)
+            
+                    ilambda = lambda_tmp(i) / datstd.get_scaleY();
+                
+                    if(i == 0)
+                        solver->init(ilambda, penalty[pp], alpha, gamma, tau);
+                    else
+                        solver->init_warm(ilambda);
+            
+                    niter[i] = solver->solve(maxit);
+                    VectorXd res = solver->get_beta();
+            
+                    double beta0 = 0.0;
+                    datstd.recover(beta0, res);
+                    beta(0,i) = beta0;
+                    beta.block(1, i, p, 1) = res;
+            
+                    if (compute_loss)
+                    {
+                        // get associated loss
+                        loss(i) = solver->get_loss();
+                    }
+            
+                    // if the design matrix includes the intercept
+                    // then don't back into the intercept with
+                    // datastd and include it to beta directly.
+                    /*
+                    if (fullbetamat)
+                    {
+                        beta.block(0, i, p+1, 1) = res;
+                        //datstd.recover(beta0, res);
+                    } else 
+                    {
+                        //datstd.recover(beta0, res);
+                        //beta(0,i) = beta0;
+                        //beta.block(1, i, p, 1) = res;
+                    }
+                    */
+            
+                } //end loop over lambda values
+            }
+        
+            lambda[pp] = lambda_tmp;
+        
+            if (penalty[pp] == "ols")
             {
-                beta.block(0, i, p+1, 1) = res;
-                //datstd.recover(beta0, res);
+                // reset to old nlambda
+                nlambda = nlambda_store;
+                beta_list(pp) = beta.col(0);
+                iter_list(pp) = niter(0);
+                loss_list(pp) = loss(0);
             } else 
             {
-                //datstd.recover(beta0, res);
-                //beta(0,i) = beta0;
-                //beta.block(1, i, p, 1) = res;
+                beta_list(pp) = beta;
+                iter_list(pp) = niter;
+                loss_list(pp) = loss;
             }
-            */
-            
-        } //end loop over lambda values
         
-        lambda[pp] = lambda_tmp;
         
-        if (penalty[pp] == "ols")
-        {
-            // reset to old nlambda
-            nlambda = nlambda_store;
-            beta_list(pp) = beta.col(0);
-            iter_list(pp) = niter(0);
-            loss_list(pp) = loss(0);
-        } else 
-        {
-            beta_list(pp) = beta;
-            iter_list(pp) = niter;
-            loss_list(pp) = loss;
-        }
-        
-        
-    } // end loop over penalties
+        } // end loop over penalties
+    }
     
     double d = solver->get_d();
 
@@ -311,3 +570,263 @@ RcppExport SEXP oem_fit_dense(SEXP x_,
 
 
 
+
+
+// fits each column of y_ as its own response, with the same 
+// penalties and options as oem_fit_dense(). X is standardized and
+// X'X and d are computed once; the oem iterations for all the 
+// responses are then done together with matrix-matrix products
+RcppExport SEXP oem_fit_dense_multi(SEXP x_, 
+                                    SEXP y_, 
+                                    SEXP family_,
+                                    SEXP penalty_,
+                                    SEXP weights_,
+                                    SEXP groups_,
+                                    SEXP unique_groups_,
+                                    SEXP group_weights_,
+                                    SEXP lambda_,
+                                    SEXP nlambda_, 
+                                    SEXP lmin_ratio_,
+                                    SEXP alpha_,
+                                    SEXP gamma_,
+                                    SEXP tau_,
+                                    SEXP penalty_factor_,
+                                    SEXP standardize_, 
+                                    SEXP intercept_,
+                                    SEXP compute_loss_,
+                                    SEXP opts_)
+{
+    BEGIN_RCPP
+    
+    Rcpp::NumericMatrix xx(x_);
+    Rcpp::NumericMatrix yy(y_);
+    
+    const int n = xx.rows();
+    const int p = xx.cols();
+    const int q = yy.cols();
+    
+    const VectorXi groups(as<VectorXi>(groups_));
+    const VectorXi unique_groups(as<VectorXi>(unique_groups_));
+    
+    MatrixXd Y(n, q);
+    
+    
+    // Copy data 
+    std::copy(yy.begin(), yy.end(), Y.data());
+    
+    VectorXd weights(as<VectorXd>(weights_));
+    VectorXd group_weights(as<VectorXd>(group_weights_));
+    
+    std::vector<VectorXd> lambda(as< std::vector<VectorXd> >(lambda_));
+    
+    int nl = as<int>(nlambda_);
+    int nlambda = lambda[0].size();
+    
+    
+    List opts(opts_);
+    const int maxit        = as<int>(opts["maxit"]);
+    int ncores             = as<int>(opts["ncores"]);
+    const double tol       = as<double>(opts["tol"]);
+    const double alpha     = as<double>(alpha_);
+    const double gamma     = as<double>(gamma_);
+    const double tau       = as<double>(tau_);
+    bool standardize       = as<bool>(standardize_);
+    bool intercept         = as<bool>(intercept_);
+    bool compute_loss      = as<bool>(compute_loss_);
+    
+    
+    CharacterVector family(as<CharacterVector>(family_));
+    std::vector<std::string> penalty(as< std::vector<std::string> >(penalty_));
+    VectorXd penalty_factor(as<VectorXd>(penalty_factor_));
+    
+    if (family(0) != "gaussian")
+    {
+        throw std::invalid_argument("several responses only available for gaussian");
+    }
+    
+    
+    // ncores < 1 takes all threads but one
+    ncores = resolve_ncores(ncores);
+    
+    omp_set_num_threads(ncores);
+    
+    // the iterations are matrix-matrix products, 
+    // which Eigen can spread over the threads
+    Eigen::initParallel();
+    Eigen::setNbThreads(ncores);
+    
+    // X is read in place from R's memory as in oem_fit_dense
+    // when its standardization can be applied to X'X and X'Y
+    bool map_x = (n > p && weights.size() == 0);
+    
+    // X is standardized once, then each response 
+    // on its own copy of the standardization
+    VectorXd Y0 = Y.col(0);
+    
+    DataStd<double> datstd(n, p, standardize, intercept);
+    if (map_x)
+    {
+        const Map<const MatrixXd> X_in(xx.begin(), n, p);
+        datstd.standardize_stats(X_in, Y0);
+        map_x = (datstd.max_mean_sd_ratio(X_in) <= max_gram_center_ratio);
+        Y0 = Y.col(0);
+    }
+    
+    MatrixXd X_copy;
+    if (!map_x)
+    {
+        X_copy.resize(n, p);
+        std::copy(xx.begin(), xx.end(), X_copy.data());
+        datstd.standardize(X_copy, Y0, weights);
+    }
+    
+    const Map<const MatrixXd> X(map_x ? xx.begin() : X_copy.data(), n, p);
+    
+    std::vector<DataStd<double> > datstd_y(q, datstd);
+    VectorXd scaleY(q);
+    for (int k = 0; k < q; ++k)
+    {
+        VectorXd Yk = Y.col(k);
+        datstd_y[k].standardize_y(Yk, weights);
+        Y.col(k) = Yk;
+        scaleY(k) = datstd_y[k].get_scaleY();
+    }
+    Y0 = Y.col(0);
+    
+    
+    oemDense *solver = new oemDense(X, Y0, weights, groups, unique_groups, 
+                                    group_weights, penalty_factor, 
+                                    intercept, standardize, 
+                                    ncores, tol);
+    
+    if (map_x)
+    {
+        solver->set_column_std(datstd.get_meanX(), datstd.get_scaleX());
+    }
+    
+    solver->init_oem();
+    solver->init_multi(Y);
+    
+    VectorXd lmax = solver->compute_lambda_zero_multi().cwiseProduct(scaleY);
+    
+    
+    bool provided_lambda = (nlambda >= 1);
+    if (!provided_lambda) 
+    {
+        nlambda = nl;
+    }
+    
+    std::string elasticnettxt(".net");
+    
+    // Rcpp vectors are not copied deeply, so each is allocated on its own
+    std::vector<List> beta_list, lambda_list, iter_list, loss_list;
+    for (int k = 0; k < q; ++k)
+    {
+        beta_list.push_back(List(penalty.size()));
+        lambda_list.push_back(List(penalty.size()));
+        iter_list.push_back(List(penalty.size()));
+        loss_list.push_back(List(penalty.size()));
+    }
+    
+    for (unsigned int pp = 0; pp < penalty.size(); pp++)
+    {
+        const int nlambda_pen = (penalty[pp] == "ols") ? 1 : nlambda;
+        
+        bool is_net_pen = penalty[pp].find(elasticnettxt) != std::string::npos;
+        
+        // lambda path of each response, on the original scale
+        MatrixXd lambda_resp(nlambda, q);
+        for (int k = 0; k < q; ++k)
+        {
+            if (provided_lambda)
+            {
+                lambda_resp.col(k) = lambda[pp];
+            } else 
+            {
+                double lmin = as<double>(lmin_ratio_) * lmax(k);
+                
+                VectorXd lambda_base(nlambda);
+                lambda_base.setLinSpaced(nlambda, std::log(lmax(k)), std::log(lmin));
+                lambda_base = lambda_base.array().exp();
+                
+                if (is_net_pen)
+                {
+                    lambda_base /= alpha;
+                }
+                lambda_resp.col(k) = lambda_base;
+            }
+        }
+        
+        std::vector<MatrixXd> beta(q, MatrixXd(p + 1, nlambda_pen));
+        std::vector<VectorXd> loss(q, VectorXd::Constant(nlambda_pen, 1e99));
+        std::vector<std::vector<int> > niter(q, std::vector<int>(nlambda_pen));
+        
+        for (int i = 0; i < nlambda_pen; i++)
+        {
+            Rcpp::checkUserInterrupt();
+            
+            VectorXd ilambda = lambda_resp.row(i).transpose().cwiseQuotient(scaleY);
+            
+            if (i == 0)
+                solver->init(ilambda(0), penalty[pp], alpha, gamma, tau);
+            
+            solver->set_lambda_multi(ilambda, i == 0);
+            solver->solve_multi(maxit);
+            
+            const MatrixXd &beta_multi = solver->get_beta_multi();
+            const std::vector<int> &niter_multi = solver->get_niter_multi();
+            
+            for (int k = 0; k < q; ++k)
+            {
+                VectorXd res = beta_multi.col(k);
+                
+                niter[k][i] = niter_multi[k];
+                
+                if (compute_loss)
+                {
+                    // get associated loss
+                    loss[k](i) = solver->get_loss_multi(k, res);
+                }
+                
+                double beta0 = 0.0;
+                datstd_y[k].recover(beta0, res);
+                beta[k](0,i) = beta0;
+                beta[k].block(1, i, p, 1) = res;
+            }
+        }
+        
+        for (int k = 0; k < q; ++k)
+        {
+            lambda_list[k](pp) = VectorXd(lambda_resp.col(k).head(nlambda_pen));
+            
+            if (penalty[pp] == "ols")
+            {
+                beta_list[k](pp) = beta[k].col(0);
+                iter_list[k](pp) = niter[k][0];
+                loss_list[k](pp) = loss[k](0);
+            } else 
+            {
+                beta_list[k](pp) = beta[k];
+                iter_list[k](pp) = wrap(niter[k]);
+                loss_list[k](pp) = loss[k];
+            }
+        }
+    } // end loop over penalties
+    
+    double d = solver->get_d();
+    
+    delete solver;
+    
+    List fits(q);
+    for (int k = 0; k < q; ++k)
+    {
+        fits(k) = List::create(Named("beta")   = beta_list[k],
+                               Named("lambda") = lambda_list[k],
+                               Named("niter")  = iter_list[k],
+                               Named("loss")   = loss_list[k],
+                               Named("d")      = d);
+    }
+    
+    return fits;
+    END_RCPP
+}
@@ -17,8 +17,10 @@
 #endif
 
 #include "oem_base.h"
+#include "oem_xtx.h"
 #include "Spectra/SymEigsSolver.h"
 #include "utils.h"
+#include "Linalg/Gram.h"
 
 
 
@@ -44,276 +46,28 @@ protected:
     const MapMatd X;            // data matrix
     MapVec Y;                   // response vector
     VectorXd weights;
-    VectorXi groups;            // vector of group membersihp indexes 
-    VectorXi unique_groups;     // vector of all unique groups
-    VectorXd penalty_factor;    // penalty multiplication factors 
-    VectorXd group_weights;     // group lasso penalty multiplication factors 
     int penalty_factor_size;    // size of penalty_factor vector
     int XXdim;                  // dimension of XX (different if n > p and p >= n)
     Vector XY;                  // X'Y
     MatrixXd XX;                // X'X
-    MatrixXd A;                 // A = d * I - X'X
-    double d;                   // d value (largest eigenvalue of X'X)
-    bool default_group_weights; // do we need to compute default group weights?
+    MatrixXf XXf;               // X'X in single precision (mixed_precision only)
     int ncores;
+    bool mixed_precision;       // store X'X in single precision when n > p
+    bool polish;                // finish each fit with double precision iterations
+    bool polishing;             // currently in the double precision polish
+    MatrixXd XY_multi;          // X'Y for each response, fitting several at once
+    MatrixXd Y_multi;           // the responses, only kept when p >= n
+    VectorXd yty_multi;         // Y'Y / n for each response, only kept when n > p
+    VectorXd x_center;          // column means X is centered by, empty if none
+    VectorXd x_scale_inv;       // inverse column scales X is divided by, empty if none
+    bool col_std;               // X is standardized through x_center and x_scale_inv
     
     
-    std::vector<std::vector<int> > grp_idx; // vector of vectors of the indexes for all members of each group
-    bool accelerate;
-    std::string penalty;        // penalty specified
     
-    double lambda;              // L1 penalty
     double lambda0;             // minimum lambda to make coefficients all zero
-    double alpha;               // alpha = mixing parameter for elastic net
-    double gamma;               // extra tuning parameter for mcp/scad
-    double tau;                 // mixing parameter for group sparse penalties
     
     double threshval;
     int wt_len;
-    double ak, ak_prev;
-    bool found_grp_idx;
-    
-    static void soft_threshold(VectorXd &res, const VectorXd &vec, const double &penalty, 
-                               VectorXd &pen_fact, double &d)
-    {
-        int v_size = vec.size();
-        res.setZero();
-        
-        const double *ptr = vec.data();
-        for(int i = 0; i < v_size; i++)
-        {
-            double total_pen = pen_fact(i) * penalty;
-            
-            if(ptr[i] > total_pen)
-                res(i) = (ptr[i] - total_pen)/d;
-            else if(ptr[i] < -total_pen)
-                res(i) = (ptr[i] + total_pen)/d;
-        }
-    }
-    
-    static void soft_threshold_mcp(VectorXd &res, const VectorXd &vec, const double &penalty, 
-                                   VectorXd &pen_fact, double &d, double &gamma)
-    {
-        int v_size = vec.size();
-        res.setZero();
-        double gammad = gamma * d;
-        double d_minus_gammainv = d - 1.0 / gamma;
-        
-        
-        const double *ptr = vec.data();
-        for(int i = 0; i < v_size; i++)
-        {
-            double total_pen = pen_fact(i) * penalty;
-            
-            if (std::abs(ptr[i]) > gammad * total_pen)
-                res(i) = ptr[i]/d;
-            else if(ptr[i] > total_pen)
-                res(i) = (ptr[i] - total_pen)/(d_minus_gammainv);
-            else if(ptr[i] < -total_pen)
-                res(i) = (ptr[i] + total_pen)/(d_minus_gammainv);
-            
-        }
-        
-    }
-    
-    static void soft_threshold_scad(VectorXd &res, const VectorXd &vec, const double &penalty, 
-                                    VectorXd &pen_fact, double &d, double &gamma)
-    {
-        int v_size = vec.size();
-        res.setZero();
-        double gammad = gamma * d;
-        double gamma_minus1_d = (gamma - 1.0) * d;
-        
-        const double *ptr = vec.data();
-        for(int i = 0; i < v_size; i++)
-        {
-            double total_pen = pen_fact(i) * penalty;
-            
-            if (std::abs(ptr[i]) > gammad * total_pen)
-                res(i) = ptr[i]/d;
-            else if (std::abs(ptr[i]) > (d + 1.0) * total_pen)
-            {
-                double gam_ptr = (gamma - 1.0) * ptr[i];
-                double gam_pen = gamma * total_pen;
-                if(gam_ptr > gam_pen)
-                    res(i) = (gam_ptr - gam_pen)/(gamma_minus1_d - 1.0);
-                else if(gam_ptr < -gam_pen)
-                    res(i) = (gam_ptr + gam_pen)/(gamma_minus1_d - 1.0);
-            }
-            else if(ptr[i] > total_pen)
-                res(i) = (ptr[i] - total_pen)/d;
-            else if(ptr[i] < -total_pen)
-                res(i) = (ptr[i] + total_pen)/d;
-            
-        }
-    }
-    
-    static double soft_threshold_scad_norm(double &b, const double &pen, double &d, double &gamma)
-    {
-        double retval = 0.0;
-        
-        double gammad = gamma * d;
-        double gamma_minus1_d = (gamma - 1.0) * d;
-        
-        if (std::abs(b) > gammad * pen)
-            retval = 1;
-        else if (std::abs(b) > (d + 1.0) * pen)
-        {
-            double gam_ptr = (gamma - 1.0);
-            double gam_pen = gamma * pen / b;
-            if(gam_ptr > gam_pen)
-                retval = d * (gam_ptr - gam_pen)/(gamma_minus1_d - 1.0);
-            else if(gam_ptr < -gam_pen)
-                retval = d * (gam_ptr + gam_pen)/(gamma_minus1_d - 1.0);
-        }
-        else if(b > pen)
-            retval = (1.0 - pen / b);
-        else if(b < -pen)
-            retval = (1.0 + pen / b);
-        return retval;
-    }
-    
-    static double soft_threshold_mcp_norm(double &b, const double &pen, double &d, double &gamma)
-    {
-        double retval = 0.0;
-        
-        double gammad = gamma * d;
-        double d_minus_gammainv = d - 1.0 / gamma;
-        
-        if (std::abs(b) > gammad * pen)
-            retval = 1;
-        else if(b > pen)
-            retval = d * (1.0 - pen / b)/(d_minus_gammainv);
-        else if(b < -pen)
-            retval = d * (1.0 + pen / b)/(d_minus_gammainv);
-        
-        return retval;
-    }
-    
-    static void block_soft_threshold_scad(VectorXd &res, const VectorXd &vec, const double &penalty,
-                                          VectorXd &pen_fact, double &d,
-                                          std::vector<std::vector<int> > &grp_idx, 
-                                          const int &ngroups, VectorXi &unique_grps, VectorXi &grps,
-                                          double & gamma)
-    {
-        //int v_size = vec.size();
-        res.setZero();
-        
-        for (int g = 0; g < ngroups; ++g) 
-        {
-            double thresh_factor;
-            std::vector<int> gr_idx = grp_idx[g];
-            
-            if (unique_grps(g) == 0) // the 0 group represents unpenalized variables
-            {
-                thresh_factor = 1.0;
-            } else 
-            {
-                double ds_norm = 0.0;
-                for (std::vector<int>::size_type v = 0; v < gr_idx.size(); ++v)
-                {
-                    int c_idx = gr_idx[v];
-                    ds_norm += std::pow(vec(c_idx), 2);
-                }
-                ds_norm = std::sqrt(ds_norm);
-                // double grp_wts = sqrt(gr_idx.size());
-                double grp_wts = pen_fact(g);
-                //thresh_factor = std::max(0.0, 1.0 - penalty * grp_wts / (ds_norm) );
-                thresh_factor = soft_threshold_scad_norm(ds_norm, penalty * grp_wts, d, gamma);
-            }
-            if (thresh_factor != 0.0)
-            {
-                for (std::vector<int>::size_type v = 0; v < gr_idx.size(); ++v)
-                {
-                    int c_idx = gr_idx[v];
-                    res(c_idx) = vec(c_idx) * thresh_factor / d;
-                }
-            }
-        }
-    }
-    
-    static void block_soft_threshold_mcp(VectorXd &res, const VectorXd &vec, const double &penalty,
-                                         VectorXd &pen_fact, double &d,
-                                         std::vector<std::vector<int> > &grp_idx, 
-                                         const int &ngroups, VectorXi &unique_grps, VectorXi &grps,
-                                         double & gamma)
-    {
-        //int v_size = vec.size();
-        res.setZero();
-        
-        for (int g = 0; g < ngroups; ++g) 
-        {
-            double thresh_factor;
-            std::vector<int> gr_idx = grp_idx[g];
-            
-            if (unique_grps(g) == 0) // the 0 group represents unpenalized variables
-            {
-                thresh_factor = 1.0;
-            } else 
-            {
-                double ds_norm = 0.0;
-                for (std::vector<int>::size_type v = 0; v < gr_idx.size(); ++v)
-                {
-                    int c_idx = gr_idx[v];
-                    ds_norm += std::pow(vec(c_idx), 2);
-                }
-                ds_norm = std::sqrt(ds_norm);
-                // double grp_wts = sqrt(gr_idx.size());
-                double grp_wts = pen_fact(g);
-                //thresh_factor = std::max(0.0, 1.0 - penalty * grp_wts / (ds_norm) );
-                thresh_factor = soft_threshold_mcp_norm(ds_norm, penalty * grp_wts, d, gamma);
-            }
-            if (thresh_factor != 0.0)
-            {
-                for (std::vector<int>::size_type v = 0; v < gr_idx.size(); ++v)
-                {
-                    int c_idx = gr_idx[v];
-                    res(c_idx) = vec(c_idx) * thresh_factor / d;
-                }
-            }
-        }
-    }
-    
-    static void block_soft_threshold(VectorXd &res, const VectorXd &vec, const double &penalty,
-                                     VectorXd &pen_fact, double &d,
-                                     std::vector<std::vector<int> > &grp_idx, 
-                                     const int &ngroups, VectorXi &unique_grps, VectorXi &grps)
-    {
-        //int v_size = vec.size();
-        res.setZero();
-        
-        for (int g = 0; g < ngroups; ++g) 
-        {
-            double thresh_factor;
-            std::vector<int> gr_idx = grp_idx[g];
-            
-            if (unique_grps(g) == 0) // the 0 group represents unpenalized variables
-            {
-                thresh_factor = 1.0;
-            } else 
-            {
-                double ds_norm = 0.0;
-                for (std::vector<int>::size_type v = 0; v < gr_idx.size(); ++v)
-                {
-                    int c_idx = gr_idx[v];
-                    ds_norm += std::pow(vec(c_idx), 2);
-                }
-                ds_norm = std::sqrt(ds_norm);
-                // double grp_wts = sqrt(gr_idx.size());
-                double grp_wts = pen_fact(g);
-                thresh_factor = std::max(0.0, 1.0 - penalty * grp_wts / (ds_norm) );
-            }
-            if (thresh_factor != 0.0)
-            {
-                for (std::vector<int>::size_type v = 0; v < gr_idx.size(); ++v)
-                {
-                    int c_idx = gr_idx[v];
-                    res(c_idx) = vec(c_idx) * thresh_factor / d;
-                }
-            }
-        }
-    }
-    
     
     MatrixXd XtX() const {
         if (ncores <= 1)
@@ -322,40 +76,10 @@ protected:
             rankUpdate(X.adjoint());
         } else 
         {
-            MatrixXd XXtmp(XXdim, XXdim);
-            XXtmp.setZero();
-            
-            int numrowscurfirst = std::floor(double(nobs) / double(ncores) );
-            
-            #pragma omp parallel
-            {
-                MatrixXd XXtmp_private(XXdim, XXdim);
-                XXtmp_private.setZero();
-                
-                // break up computation of X'X into 
-                // X'X = X_1'X_1 + ... + X_ncores'X_ncores
-                #pragma omp for schedule(static) nowait
-                for (int ff = 0; ff < ncores; ++ff)
-                {
-                    
-                    if (ff + 1 == ncores)
-                    {
-                        int numrowscur = nobs - (ncores - 1) * std::floor(double(nobs) / double(ncores));
-                        XXtmp_private += MatrixXd(XXdim, XXdim).setZero().selfadjointView<Lower>().
-                                         rankUpdate(X.bottomRows(numrowscur).adjoint());
-                    } else 
-                    {
-                        XXtmp_private += MatrixXd(XXdim, XXdim).setZero().selfadjointView<Lower>().
-                                         rankUpdate(X.middleRows(ff * numrowscurfirst, numrowscurfirst).adjoint());
-                    }
-                }
-                #pragma omp critical
-                {
-                    XXtmp += XXtmp_private; 
-                }
-                
-                
-            }
+            // tiled X'X, each thread computes whole tiles of the
+            // lower triangle so there is no per-thread p x p copy
+            MatrixXd XXtmp;
+            Linalg::gram_tiled(XXtmp, X, (const double*) NULL, ncores);
             return XXtmp;
         }
     }
@@ -366,56 +90,16 @@ protected:
     }
     
     MatrixXd XtWX() const {
-        
-        if (ncores <= 1)
-        {
-            return MatrixXd(XXdim, XXdim).setZero().selfadjointView<Lower>().
-            rankUpdate(X.adjoint() * (weights.array().sqrt().matrix()).asDiagonal() );
-        } else 
-        {
-            MatrixXd XXtmp(XXdim, XXdim);
-            XXtmp.setZero();
-            
-            int numrowscurfirst = std::floor(double(nobs) / double(ncores));
-            
-            #pragma omp parallel
-            {
-                MatrixXd XXtmp_private(XXdim, XXdim);
-                XXtmp_private.setZero();
-                
-                // break up computation of X'X into 
-                // X'X = X_1'X_1 + ... + X_ncores'X_ncores
-                
-                #pragma omp for schedule(static) nowait
-                for (int ff = 0; ff < ncores; ++ff)
-                {
-                    
-                    if (ff + 1 == ncores)
-                    {
-                        int numrowscur = nobs - (ncores - 1) * std::floor(double(nobs) / double(ncores));
-                        XXtmp_private += MatrixXd(XXdim, XXdim).setZero().selfadjointView<Lower>().
-                                         rankUpdate(X.bottomRows(numrowscur).adjoint() * 
-                                         (weights.tail(numrowscur).array().sqrt().matrix()).asDiagonal());
-                    } else 
-                    {
-                        XXtmp_private += MatrixXd(XXdim, XXdim).setZero().selfadjointView<Lower>().
-                                         rankUpdate(X.middleRows(ff * numrowscurfirst, numrowscurfirst).adjoint() * 
-                                         (weights.segment(ff * numrowscurfirst, numrowscurfirst).array().sqrt().matrix()).asDiagonal());
-                    }
-                }
-                #pragma omp critical
-                {
-                    XXtmp += XXtmp_private; 
-                }
-                
-            }
-            return XXtmp;
-        }
+        // weights are applied inside the tiled product
+        MatrixXd XXtmp;
+        Linalg::gram_tiled(XXtmp, X, weights.data(), ncores);
+        return XXtmp;
     }
     
     MatrixXd XWXt() const {
-        return MatrixXd(nobs, nobs).setZero().selfadjointView<Lower>().
-        rankUpdate( (weights.array().sqrt().matrix()).asDiagonal() * X );
+        MatrixXd XXtmp;
+        Linalg::outer_gram_weighted(XXtmp, X, weights);
+        return XXtmp;
     }
     
     void get_group_indexes()
@@ -426,20 +110,7 @@ protected:
         if (penalty.find(grptxt) != std::string::npos)
         {
             found_grp_idx = true;
-            grp_idx.reserve(ngroups);
-            for (int g = 0; g < ngroups; ++g) 
-            {
-                // find all variables in group number g
-                std::vector<int> idx_tmp;
-                for (int v = 0; v < nvars; ++v) 
-                {
-                    if (groups(v) == unique_groups(g)) 
-                    {
-                        idx_tmp.push_back(v);
-                    }
-                }
-                grp_idx[g] = idx_tmp;
-            }
+            grp_idx.build(groups, unique_groups, nvars);
             // if group weights were not specified,
             // then set the group weight for each
             // group to be the sqrt of the size of the
@@ -449,7 +120,7 @@ protected:
                 group_weights.resize(ngroups);
                 for (int g = 0; g < ngroups; ++g) 
                 {
-                    group_weights(g) = std::sqrt(double(grp_idx[g].size()));
+                    group_weights(g) = std::sqrt(double(grp_idx.size(g)));
                 }
             }
         }
@@ -480,6 +151,20 @@ protected:
             }
         }
         
+        // the Gram of the standardized X is
+        // S^-1 (X'X - n * m m') S^-1 for means m and scales S
+        if (col_std)
+        {
+            if (x_center.size())
+            {
+                XX.noalias() -= double(nobs) * x_center * x_center.transpose();
+            }
+            if (x_scale_inv.size())
+            {
+                XX = x_scale_inv.asDiagonal() * XX * x_scale_inv.asDiagonal();
+            }
+        }
+        
         XX /= nobs;
         
         Spectra::DenseSymMatProd<double> op(XX);
@@ -497,11 +182,18 @@ protected:
         Vector eigenvals = eigs.eigenvalues();
         d = eigenvals[0] * 1.005; // multiply by an increasing factor to be safe
         
-        
-        if (nobs > nvars)
+        // d comes from the double precision X'X above. the 
+        // polish iterates on it, so it is only dropped without 
+        // a polish; with one X'X takes 1.5 times the memory of 
+        // a double precision fit, though each single precision 
+        // iteration still reads half as much
+        if (mixed_precision && nobs > nvars)
         {
-            A = -XX;
-            A.diagonal().array() += d;
+            XXf = XX.cast<float>();
+            if (!polish)
+            {
+                XX.resize(0, 0);
+            }
         }
     }
     
@@ -509,147 +201,166 @@ protected:
     {
         if (nobs > nvars)
         {
-            res.noalias() = A * beta_prev + XY;
+            if (mixed_precision && !polishing)
+            {
+                sparse_A_prod(res, XXf, beta_prev, XY);
+            } else
+            {
+                sparse_A_prod(res, XX, beta_prev, XY);
+            }
         } else 
         {
+            VectorXd resid(nobs);
+            std_design_prod(resid, beta_prev);
+            resid = Y - resid;
+            
             if (wt_len)
             {
-                res.noalias() = X.adjoint() * ((Y - X * beta_prev).array() * weights.array().square()).matrix() / double(nobs) + d * beta_prev;
-            } else
-            {
-                res.noalias() = X.adjoint() * (Y - X * beta_prev) / double(nobs) + d * beta_prev;
+                resid.array() *= weights.array().square();
             }
+            
+            std_crossprod(res, resid);
+            res /= double(nobs);
+            res += d * beta_prev;
         }
         
     }
     
-    
-    void next_beta(Vector &res)
+    // res = X * b for X standardized as set_column_std() gives
+    void std_design_prod(VectorXd &res, const VectorXd &b)
     {
-        VectorXd beta_last = beta;
-        if (penalty == "lasso")
-        {
-            soft_threshold(beta, u, lambda, penalty_factor, d);
-        } else if (penalty == "ols")
+        if (!col_std)
         {
-            beta = u / d;
-        } else if (penalty == "elastic.net")
+            sparse_design_prod(res, X, b);
+            return;
+        }
+        
+        VectorXd b_scaled = b;
+        if (x_scale_inv.size())
         {
-            double denom = d + (1.0 - alpha) * lambda;
-            double lam = lambda * alpha;
-            
-            soft_threshold(beta, u, lam, penalty_factor, denom);
-        } else if (penalty == "scad") 
+            b_scaled.array() *= x_scale_inv.array();
+        }
+        
+        sparse_design_prod(res, X, b_scaled);
+        
+        if (x_center.size())
         {
-            soft_threshold_scad(beta, u, lambda, penalty_factor, d, gamma);
-            
-        } else if (penalty == "scad.net") 
+            res.array() -= x_center.dot(b_scaled);
+        }
+    }
+    
+    // res = X' * r for X standardized as set_column_std() gives
+    void std_crossprod(VectorXd &res, const VectorXd &r)
+    {
+        screened_crossprod(res, X, r);
+        
+        if (col_std)
         {
-            double denom = d + (1.0 - alpha) * lambda;
-            double lam = lambda * alpha;
-            
-            if (alpha == 0)
+            if (x_center.size())
             {
-                lam   = 0;
-                denom = d + lambda;
+                res.noalias() -= r.sum() * x_center;
             }
-            
-            soft_threshold_scad(beta, u, lam, penalty_factor, denom, gamma);
+            if (x_scale_inv.size())
+            {
+                res.array() *= x_scale_inv.array();
+            }
+        }
+    }
+    
+    double xy_dot(const VectorXd &b) const
+    {
+        return b.dot(XY);
+    }
+    
+    // the products with X'X (or X and X') for all the 
+    // responses in cols are single matrix-matrix products
+    void next_u_multi(MatrixXd &res, const MatrixXd &b, const std::vector<int> &cols)
+    {
+        const int nact = cols.size();
         
-        } else if (penalty == "mcp") 
-        {
-            soft_threshold_mcp(beta, u, lambda, penalty_factor, d, gamma);
-        } else if (penalty == "mcp.net") 
-        {
-            double denom = d + (1.0 - alpha) * lambda;
-            double lam = lambda * alpha;
-
-            soft_threshold_mcp(beta, u, lam, penalty_factor, denom, gamma);
-            
-        } else if (penalty == "grp.lasso")
-        {
-            block_soft_threshold(beta, u, lambda, group_weights,
-                                 d, grp_idx, ngroups, 
-                                 unique_groups, groups);
-        } else if (penalty == "grp.lasso.net")
-        {
-            double denom = d + (1.0 - alpha) * lambda;
-            double lam = lambda * alpha;
-            
-            block_soft_threshold(beta, u, lam, group_weights,
-                                 denom, grp_idx, ngroups, 
-                                 unique_groups, groups);
-            
-        } else if (penalty == "grp.mcp")
-        {
-            block_soft_threshold_mcp(beta, u, lambda, group_weights,
-                                     d, grp_idx, ngroups, 
-                                     unique_groups, groups, gamma);
-        } else if (penalty == "grp.scad")
+        if (nobs > nvars)
         {
-            block_soft_threshold_scad(beta, u, lambda, group_weights,
-                                      d, grp_idx, ngroups, 
-                                      unique_groups, groups, gamma);
-        } else if (penalty == "grp.mcp.net")
+            res.resize(nvars, nact);
+            for (int k = 0; k < nact; ++k)
+            {
+                res.col(k) = XY_multi.col(cols[k]);
+            }
+            res.noalias() -= XX.selfadjointView<Lower>() * b;
+        } else 
         {
-            double denom = d + (1.0 - alpha) * lambda;
-            double lam = lambda * alpha;
-            
+            MatrixXd resid(nobs, nact);
+            for (int k = 0; k < nact; ++k)
+            {
+                resid.col(k) = Y_multi.col(cols[k]);
+            }
+            resid.noalias() -= X * b;
             
-            block_soft_threshold_mcp(beta, u, lam, group_weights,
-                                     denom, grp_idx, ngroups, 
-                                     unique_groups, groups, gamma);
-        } else if (penalty == "grp.scad.net")
-        {
-            double denom = d + (1.0 - alpha) * lambda;
-            double lam = lambda * alpha;
+            if (wt_len)
+            {
+                resid = weights.array().square().matrix().asDiagonal() * resid;
+            }
             
-            block_soft_threshold_scad(beta, u, lam, group_weights,
-                                      denom, grp_idx, ngroups, 
-                                      unique_groups, groups, gamma);
-        } else if (penalty == "sparse.grp.lasso")
+            res.noalias() = X.transpose() * resid;
+            res /= double(nobs);
+        }
+        res += d * b;
+    }
+    
+    bool next_u_delta(Vector &res, const Vector &delta)
+    {
+        if (nobs > nvars)
         {
-            double lam_grp = (1.0 - tau) * lambda;
-            double lam_l1  = tau * lambda;
-            
-            double fact = 1.0;
-            
-            // first apply soft thresholding
-            // but don't divide by d
-            soft_threshold(beta, u, lam_l1, penalty_factor, fact);
-            
-            VectorXd beta_tmp = beta;
-            
-            // then apply block soft thresholding
-            block_soft_threshold(beta, beta_tmp, lam_grp, 
-                                 group_weights,
-                                 d, grp_idx, ngroups, 
-                                 unique_groups, groups);
+            if (mixed_precision && !polishing)
+            {
+                add_sparse_A_prod(res, XXf, delta);
+            } else
+            {
+                add_sparse_A_prod(res, XX, delta);
+            }
+            return true;
         }
-        
-        
-        
-        
-        if (accelerate)
+        return false;
+    }
+    
+    bool sub_gram(MatrixXd &xx_sub, VectorXd &xy_sub, const std::vector<int> &idx)
+    {
+        if (nobs > nvars)
         {
-            ak_prev = ak;
-            ak      = 0.5 * (1 + std::sqrt(1.0 + 4.0 * std::pow(ak, 2)));
-            double ratio_k = (ak_prev - 1.0) / ak;
-            
-            VectorXd beta_update = beta;
-            VectorXd beta_diff = beta - beta_last;
-            beta.array() += ratio_k * beta_diff.array();
-            
-            double adaptive_val = ((beta.array() - beta_update.array()).array() * 
-                                   beta_diff.array()).sum();
-                
-            if (adaptive_val > 0)
+            if (mixed_precision && !polishing)
             {
-                ak = 1;
-                //beta = beta_last.array() * 0.90 + beta.array() * 0.1;
+                sub_gram_from_XX(xx_sub, xy_sub, XXf, XY, idx);
+            } else
+            {
+                sub_gram_from_XX(xx_sub, xy_sub, XX, XY, idx);
+            }
+            return true;
+        } else if (!wt_len)
+        {
+            // X'X is not formed when p >= n, so 
+            // compute X_S'X_S from the columns of X
+            const int nsub = idx.size();
+            MatrixXd X_sub(nobs, nsub);
+            xy_sub.resize(nsub);
+            for (int k = 0; k < nsub; ++k)
+            {
+                X_sub.col(k) = X.col(idx[k]);
+                xy_sub(k)    = XY(idx[k]);
+                
+                if (col_std)
+                {
+                    if (x_center.size())
+                        X_sub.col(k).array() -= x_center(idx[k]);
+                    if (x_scale_inv.size())
+                        X_sub.col(k) *= x_scale_inv(idx[k]);
+                }
             }
+            
+            xx_sub = MatrixXd(nsub, nsub).setZero().selfadjointView<Lower>().
+                rankUpdate(X_sub.adjoint());
+            xx_sub /= nobs;
+            return true;
         }
-        
+        return false;
     }
     
     
@@ -665,31 +376,52 @@ public:
              bool &standardize_,
              int &ncores_,
              const double tol_ = 1e-6,
-             const bool accelerate_ = false) :
+             const bool accelerate_ = false,
+             const bool mixed_precision_ = false,
+             const bool polish_ = true) :
     oemBase<Eigen::VectorXd>(X_.rows(), 
                              X_.cols(),
-                             unique_groups_.size(),
+                             groups_,
+                             unique_groups_,
+                             group_weights_,
+                             penalty_factor_,
                              intercept_, 
                              standardize_,
-                             tol_),
+                             tol_,
+                             accelerate_),
                              X(X_.data(), X_.rows(), X_.cols()),
                              Y(Y_.data(), Y_.size()),
                              weights(weights_),
-                             groups(groups_),
-                             unique_groups(unique_groups_),
-                             penalty_factor(penalty_factor_),
-                             group_weights(group_weights_),
                              penalty_factor_size(penalty_factor_.size()),
                              XXdim( std::min(X_.cols(), X_.rows()) ),
                              XY(X_.cols()), // add extra space if intercept but no standardize
                              XX(XXdim, XXdim),                                // add extra space if intercept but no standardize
-                             default_group_weights(bool(group_weights_.size() < 1)), // compute default weights if none given
                              ncores(ncores_),
-                             grp_idx(unique_groups_.size()),
-                             accelerate(accelerate_)
+                             mixed_precision(mixed_precision_),
+                             polish(polish_),
+                             polishing(false),
+                             col_std(false)
     
     {}
     
+    // fit as if X were centered by center_ and divided by scale_ 
+    // (either may be empty to skip it) without changing X, so X 
+    // can be read-only memory owned by the caller. the centering 
+    // and scaling are applied to X'X and X'Y instead. only 
+    // available when n > p without weights, and must be called 
+    // before init_oem()
+    void set_column_std(const VectorXd &center_, const VectorXd &scale_)
+    {
+        if (nobs <= nvars || weights.size())
+        {
+            throw std::invalid_argument("column standardization of X'X needs n > p and no weights");
+        }
+        
+        x_center    = center_;
+        x_scale_inv = scale_.size() ? VectorXd(scale_.cwiseInverse()) : VectorXd(0);
+        col_std     = (x_center.size() > 0 || x_scale_inv.size() > 0);
+    }
+    
     void init_oem()
     {
         found_grp_idx = false;
@@ -704,11 +436,29 @@ public:
             XY.noalias() = X.transpose() * Y;
         }
         
+        if (col_std)
+        {
+            if (x_center.size())
+            {
+                XY.noalias() -= Y.sum() * x_center;
+            }
+            if (x_scale_inv.size())
+            {
+                XY.array() *= x_scale_inv.array();
+            }
+        }
+        
         XY /= nobs;
         
         // compute XtX or XXt (depending on if n > p or not)
-        // and compute A = dI - XtX (if n > p)
         compute_XtX_d_update_A();
+        
+        // Y'Y for the duality gap. when p >= n with weights
+        // the iterations use squared weights, which X'Y does not
+        if (!(wt_len && nobs <= nvars))
+        {
+            yty = (wt_len ? (Y.array().square() * weights.array()).sum() : Y.squaredNorm()) / nobs;
+        }
     }
     
     double compute_lambda_zero() 
@@ -716,7 +466,52 @@ public:
         lambda0 = XY.cwiseAbs().maxCoeff();
         return lambda0; 
     }
-    double get_d() { return d; }
+    
+    // X'Y for each column of Y_, to fit the columns as separate 
+    // responses with solve_multi(). this is one matrix-matrix 
+    // product. init_oem() must have been called without mixed 
+    // precision, as the responses are fit with the double X'X
+    void init_multi(const MatrixXd &Y_)
+    {
+        if (wt_len)
+        {
+            XY_multi.noalias() = X.transpose() * (weights.asDiagonal() * Y_);
+        } else
+        {
+            XY_multi.noalias() = X.transpose() * Y_;
+        }
+        
+        if (col_std)
+        {
+            if (x_center.size())
+            {
+                XY_multi.noalias() -= x_center * Y_.colwise().sum();
+            }
+            if (x_scale_inv.size())
+            {
+                XY_multi = x_scale_inv.asDiagonal() * XY_multi;
+            }
+        }
+        
+        XY_multi /= nobs;
+        
+        if (nobs <= nvars)
+        {
+            Y_multi = Y_;
+        } else if (wt_len)
+        {
+            yty_multi = (Y_.array().square().colwise() * weights.array()).colwise().sum().transpose() / double(nobs);
+        } else 
+        {
+            yty_multi = Y_.colwise().squaredNorm().transpose() / double(nobs);
+        }
+    }
+    
+    // the smallest lambda making the coefficients all zero, for each response
+    VectorXd compute_lambda_zero_multi() const
+    {
+        return XY_multi.cwiseAbs().colwise().maxCoeff().transpose();
+    }
     
     // init() is a cold start for the first lambda.
     // init() called before each penalty 
@@ -726,7 +521,7 @@ public:
         beta.setZero();
         
         lambda = lambda_;
-        penalty = penalty_;
+        set_penalty(penalty_);
         
         alpha = alpha_;
         gamma = gamma_;
@@ -751,6 +546,22 @@ public:
         lambda = lambda_;
     }
     
+    // with mixed precision, the single precision iterations get
+    // close to the solution cheaply and the polish then converges 
+    // to the same tolerance as a double precision fit
+    virtual int solve(int maxit)
+    {
+        int iters = oemBase<Eigen::VectorXd>::solve(maxit);
+        
+        if (mixed_precision && polish && nobs > nvars)
+        {
+            polishing = true;
+            iters += oemBase<Eigen::VectorXd>::solve(maxit);
+            polishing = false;
+        }
+        return iters;
+    }
+    
     VectorXd get_beta() 
     { 
         return beta;
@@ -758,16 +569,73 @@ public:
     
     virtual double get_loss()
     {
+        return get_loss(beta);
+    }
+    
+    // when X'X is held this is computed from X'X, X'Y 
+    // and y'y without another pass over X
+    double get_loss(const VectorXd &beta_) const
+    {
+        if (nobs > nvars && yty >= 0.0)
+        {
+            if (mixed_precision && !polish)
+            {
+                return gram_loss(XXf, XY, beta_);
+            }
+            return gram_loss(XX, XY, beta_);
+        }
+        
         double loss;
         if (wt_len)
         {
-            loss = ((Y - X * beta).array().square() * weights.array()).sum();
+            loss = ((Y - X * beta_).array().square() * weights.array()).sum();
         } else 
         {
-            loss = (Y - X * beta).array().square().sum();
+            loss = (Y - X * beta_).array().square().sum();
         }
         return loss;
     }
+    
+    // the loss of response k of init_multi() at beta_, from X'X,
+    // X'Y and y'y when n > p as get_loss() is
+    double get_loss_multi(int k, const VectorXd &beta_) const
+    {
+        if (nobs > nvars)
+        {
+            return gram_loss(XX, VectorXd(XY_multi.col(k)), beta_, yty_multi(k));
+        }
+        
+        if (wt_len)
+        {
+            return ((Y_multi.col(k) - X * beta_).array().square() * weights.array()).sum();
+        }
+        return (Y_multi.col(k) - X * beta_).array().square().sum();
+    }
+    
+    // whether gram_solver() is available
+    bool can_share_gram() const
+    {
+        return (nobs > nvars && !mixed_precision);
+    }
+    
+    // a solver for the same problem that reads this solver's 
+    // X'X, d and options, so that segments of the lambda path 
+    // can be fit on separate threads without copying X'X. 
+    // init_oem() must have been called and can_share_gram() 
+    // must hold. the caller owns the returned solver
+    oemXTX *gram_solver() const
+    {
+        VectorXd group_weights_seg(group_weights);
+        VectorXd penalty_factor_seg(penalty_factor);
+        VectorXd scale_factor_seg(0);
+        
+        oemXTX *solver_seg = new oemXTX(XX, XY, groups, unique_groups,
+                                        group_weights_seg, penalty_factor_seg,
+                                        scale_factor_seg, tol);
+        solver_seg->copy_options(*this);
+        solver_seg->init_oem(d);
+        return solver_seg;
+    }
 };
 
 
@@ -54,14 +54,16 @@ RcppExport SEXP oem_fit_fb_big(SEXP x_,
     const int n = bMPtr->nrow();
     const int p = bMPtr->ncol();
     
+    // char, unsigned char, short, int, float and double 
+    // big.matrix objects are all read in their own type
     unsigned int typedata = bMPtr->matrix_type();
     
-    if (typedata != 8)
+    if (typedata != 1 && typedata != 2 && typedata != 3 && 
+        typedata != 4 && typedata != 6 && typedata != 8)
     {
         throw Rcpp::exception("type for provided big.matrix not available");
     }
     
-    const Map<MatrixXd>  X = Map<MatrixXd>((double *)bMPtr->matrix(), bMPtr->nrow(), bMPtr->ncol()  );
     const Map<VectorXd>  Y(as<Map<VectorXd> >(y_));
     
     const VectorXi groups(as<VectorXi>(groups_));
@@ -90,7 +92,12 @@ RcppExport SEXP oem_fit_fb_big(SEXP x_,
     List opts(opts_);
     const int maxit        = as<int>(opts["maxit"]);
     const double tol       = as<double>(opts["tol"]);
+    const int aa_depth     = as<int>(opts["anderson_depth"]);
+    const bool screen      = as<bool>(opts["screen"]);
+    const int gap_freq     = as<int>(opts["gap_freq"]);
+    std::vector<std::string> stop_rule(as< std::vector<std::string> >(opts["stop.rule"]));
     const double gigs      = as<double>(opts["gigs"]);
+    int ncores             = as<int>(opts["ncores"]);
     const double alpha     = as<double>(alpha_);
     const double gamma     = as<double>(gamma_);
     const double tau       = as<double>(tau_);
@@ -112,6 +119,9 @@ RcppExport SEXP oem_fit_fb_big(SEXP x_,
         
     }
     
+    // ncores < 1 takes all threads but one
+    ncores = resolve_ncores(ncores);
+    
     // initialize pointers 
     oemBase<Eigen::VectorXd> *solver = NULL; // solver doesn't point to anything yet
     
@@ -120,15 +130,27 @@ RcppExport SEXP oem_fit_fb_big(SEXP x_,
     
     if (family(0) == "gaussian")
     {
-        solver = new oemBig(X, Y, weights, groups, unique_groups, 
-                            group_weights, penalty_factor, 
-                            intercept, standardize, tol, gigs);
+        solver = new_oem_big(bMPtr.get(), Y, weights, groups, unique_groups, 
+                             group_weights, penalty_factor, 
+                             intercept, standardize, tol, gigs, ncores);
     } else if (family(0) == "binomial")
     {
         throw std::invalid_argument("binomial not available for oem_fit_dense, use oem_fit_logistic_dense");
         //solver = new oem(X, Y, penalty_factor, irls_tol, irls_maxit, eps_abs, eps_rel);
     }
     
+    // safeguarded Anderson acceleration of the oem iterations
+    solver->set_anderson(aa_depth);
+    
+    // strong rule screening along the lambda path
+    solver->set_screen(screen);
+    
+    // check convergence with the duality gap where it is available
+    if (stop_rule[0] == "duality.gap")
+    {
+        solver->set_gap_freq(gap_freq);
+    }
+    
     // compute initial pieces of oem
     solver->init_oem();
     
@@ -91,6 +91,7 @@ RcppExport SEXP oem_fit_logistic_dense(SEXP x_,
     const int irls_maxit   = as<int>(opts["irls_maxit"]);
     const double irls_tol  = as<double>(opts["irls_tol"]);
     const double tol       = as<double>(opts["tol"]);
+    const int aa_depth     = as<int>(opts["anderson_depth"]);
     const double alpha     = as<double>(alpha_);
     const double gamma     = as<double>(gamma_);
     const double tau       = as<double>(tau_);
@@ -104,11 +105,8 @@ RcppExport SEXP oem_fit_logistic_dense(SEXP x_,
     std::vector<std::string> hessian_type(as< std::vector<std::string> >(opts["hessian.type"]));
     VectorXd penalty_factor(as<VectorXd>(penalty_factor_));
     
-    // take all threads but one
-    if (ncores < 1)
-    {
-        ncores = std::max(omp_get_num_threads() - 1, 1);
-    }
+    // ncores < 1 takes all threads but one
+    ncores = resolve_ncores(ncores);
     
     omp_set_num_threads(ncores);
     
@@ -153,6 +151,9 @@ RcppExport SEXP oem_fit_logistic_dense(SEXP x_,
                                   irls_maxit, irls_tol, tol);
     
     
+    // safeguarded Anderson acceleration of the oem iterations
+    solver->set_anderson(aa_depth);
+    
     // compute initial pieces of oem
     solver->init_oem();
     
@@ -19,6 +19,7 @@
 #include "oem_base.h"
 #include "Spectra/SymEigsSolver.h"
 #include "utils.h"
+#include "Linalg/Gram.h"
 
 
 
@@ -48,17 +49,10 @@ protected:
     VectorXd prob;              // 1 / (1 + exp(-x * beta))
     VectorXd grad;
     VectorXd weights;
-    VectorXi groups;            // vector of group membersihp indexes 
-    VectorXi unique_groups;     // vector of all unique groups
-    VectorXd penalty_factor;    // penalty multiplication factors 
-    VectorXd group_weights;     // group lasso penalty multiplication factors 
     int penalty_factor_size;    // size of penalty_factor vector
     int XXdim;                  // dimension of XX (different if n > p and p >= n)
     Vector XY;                  // X'Y
     MatrixXd XX;                // X'X
-    MatrixXd A;                 // A = d * I - X'X
-    double d;                   // d value (largest eigenvalue of X'X)
-    bool default_group_weights; // do we need to compute default group weights?
     int ncores;
     std::string hessian_type;
     int irls_maxit;
@@ -67,263 +61,15 @@ protected:
     Eigen::RowVectorXd colsums;
     Eigen::RowVectorXd colsq;
     Eigen::VectorXd colsq_inv;
+    VectorXd W_eig;             // IRLS weights of the X'WX the last d was computed for
+    double xx_trace;            // trace of the unweighted XX, before dividing by nobs
     
-    std::vector<std::vector<int> > grp_idx; // vector of vectors of the indexes for all members of each group
-    std::string penalty;        // penalty specified
     
-    double lambda;              // L1 penalty
     double lambda0;             // minimum lambda to make coefficients all zero
-    double alpha;               // alpha = mixing parameter for elastic net
-    double gamma;               // extra tuning parameter for mcp/scad
-    double tau;                 // mixing parameter for group sparse penalties
     
     double threshval;
     int wt_len;
     bool on_lam_1;
-    bool found_grp_idx;
-    
-    static void soft_threshold(VectorXd &res, const VectorXd &vec, const double &penalty, 
-                               VectorXd &pen_fact, double &d)
-    {
-        int v_size = vec.size();
-        
-        res.setZero();
-        
-        const double *ptr = vec.data();
-        for(int i = 0; i < v_size; i++)
-        {
-            double total_pen = pen_fact(i) * penalty;
-            
-            if(ptr[i] > total_pen)
-                res(i) = (ptr[i] - total_pen)/d;
-            else if(ptr[i] < -total_pen)
-                res(i) = (ptr[i] + total_pen)/d;
-        }
-    }
-    
-    static void soft_threshold_mcp(VectorXd &res, const VectorXd &vec, const double &penalty, 
-                                   VectorXd &pen_fact, double &d, double &gamma)
-    {
-        int v_size = vec.size();
-        res.setZero();
-        double gammad = gamma * d;
-        double d_minus_gammainv = d - 1.0 / gamma;
-        
-        
-        const double *ptr = vec.data();
-        for(int i = 0; i < v_size; i++)
-        {
-            double total_pen = pen_fact(i) * penalty;
-            
-            if (std::abs(ptr[i]) > gammad * total_pen)
-                res(i) = ptr[i]/d;
-            else if(ptr[i] > total_pen)
-                res(i) = (ptr[i] - total_pen)/(d_minus_gammainv);
-            else if(ptr[i] < -total_pen)
-                res(i) = (ptr[i] + total_pen)/(d_minus_gammainv);
-            
-        }
-        
-    }
-    
-    static void soft_threshold_scad(VectorXd &res, const VectorXd &vec, const double &penalty, 
-                                    VectorXd &pen_fact, double &d, double &gamma)
-    {
-        int v_size = vec.size();
-        res.setZero();
-        double gammad = gamma * d;
-        double gamma_minus1_d = (gamma - 1) * d;
-        
-        const double *ptr = vec.data();
-        for(int i = 0; i < v_size; i++)
-        {
-            double total_pen = pen_fact(i) * penalty;
-            
-            if (std::abs(ptr[i]) > gammad * total_pen)
-                res(i) = ptr[i]/d;
-            else if (std::abs(ptr[i]) > (d + 1.0) * total_pen)
-            {
-                double gam_ptr = (gamma - 1.0) * ptr[i];
-                double gam_pen = gamma * total_pen;
-                if(gam_ptr > gam_pen)
-                    res(i) = (gam_ptr - gam_pen)/(gamma_minus1_d - 1.0);
-                else if(gam_ptr < -gam_pen)
-                    res(i) = (gam_ptr + gam_pen)/(gamma_minus1_d - 1.0);
-            }
-            else if(ptr[i] > total_pen)
-                res(i) = (ptr[i] - total_pen)/d;
-            else if(ptr[i] < -total_pen)
-                res(i) = (ptr[i] + total_pen)/d;
-            
-        }
-    }
-    
-    static double soft_threshold_scad_norm(double &b, const double &pen, double &d, double &gamma)
-    {
-        double retval = 0.0;
-        
-        double gammad = gamma * d;
-        double gamma_minus1_d = (gamma - 1.0) * d;
-        
-        if (std::abs(b) > gammad * pen)
-            retval = 1.0;
-        else if (std::abs(b) > (d + 1.0) * pen)
-        {
-            double gam_ptr = (gamma - 1.0);
-            double gam_pen = gamma * pen / b;
-            if(gam_ptr > gam_pen)
-                retval = d * (gam_ptr - gam_pen)/(gamma_minus1_d - 1.0);
-            else if(gam_ptr < -gam_pen)
-                retval = d * (gam_ptr + gam_pen)/(gamma_minus1_d - 1.0);
-        }
-        else if(b > pen)
-            retval = (1.0 - pen / b);
-        else if(b < -pen)
-            retval = (1.0 + pen / b);
-        return retval;
-    }
-    
-    static double soft_threshold_mcp_norm(double &b, const double &pen, double &d, double &gamma)
-    {
-        double retval = 0.0;
-        
-        double gammad = gamma * d;
-        double d_minus_gammainv = d - 1.0 / gamma;
-        
-        if (std::abs(b) > gammad * pen)
-            retval = 1.0;
-        else if(b > pen)
-            retval = d * (1.0 - pen / b)/(d_minus_gammainv);
-        else if(b < -pen)
-            retval = d * (1.0 + pen / b)/(d_minus_gammainv);
-        
-        return retval;
-    }
-    
-    static void block_soft_threshold_scad(VectorXd &res, const VectorXd &vec, const double &penalty,
-                                          VectorXd &pen_fact, double &d,
-                                          std::vector<std::vector<int> > &grp_idx, 
-                                          const int &ngroups, VectorXi &unique_grps, VectorXi &grps,
-                                          double & gamma)
-    {
-        //int v_size = vec.size();
-        res.setZero();
-        
-        for (int g = 0; g < ngroups; ++g) 
-        {
-            double thresh_factor;
-            std::vector<int> gr_idx = grp_idx[g];
-            
-            if (unique_grps(g) == 0) // the 0 group represents unpenalized variables
-            {
-                thresh_factor = 1.0;
-            } else 
-            {
-                double ds_norm = 0.0;
-                for (std::vector<int>::size_type v = 0; v < gr_idx.size(); ++v)
-                {
-                    int c_idx = gr_idx[v];
-                    ds_norm += std::pow(vec(c_idx), 2);
-                }
-                ds_norm = std::sqrt(ds_norm);
-                // double grp_wts = sqrt(gr_idx.size());
-                double grp_wts = pen_fact(g);
-                //thresh_factor = std::max(0.0, 1.0 - penalty * grp_wts / (ds_norm) );
-                thresh_factor = soft_threshold_scad_norm(ds_norm, penalty * grp_wts, d, gamma);
-            }
-            if (thresh_factor != 0.0)
-            {
-                for (std::vector<int>::size_type v = 0; v < gr_idx.size(); ++v)
-                {
-                    int c_idx = gr_idx[v];
-                    res(c_idx) = vec(c_idx) * thresh_factor / d;
-                }
-            }
-        }
-    }
-    
-    static void block_soft_threshold_mcp(VectorXd &res, const VectorXd &vec, const double &penalty,
-                                         VectorXd &pen_fact, double &d,
-                                         std::vector<std::vector<int> > &grp_idx, 
-                                         const int &ngroups, VectorXi &unique_grps, VectorXi &grps,
-                                         double & gamma)
-    {
-        //int v_size = vec.size();
-        res.setZero();
-        
-        for (int g = 0; g < ngroups; ++g) 
-        {
-            double thresh_factor;
-            std::vector<int> gr_idx = grp_idx[g];
-            
-            if (unique_grps(g) == 0) // the 0 group represents unpenalized variables
-            {
-                thresh_factor = 1.0;
-            } else 
-            {
-                double ds_norm = 0.0;
-                for (std::vector<int>::size_type v = 0; v < gr_idx.size(); ++v)
-                {
-                    int c_idx = gr_idx[v];
-                    ds_norm += std::pow(vec(c_idx), 2);
-                }
-                ds_norm = std::sqrt(ds_norm);
-                // double grp_wts = sqrt(gr_idx.size());
-                double grp_wts = pen_fact(g);
-                //thresh_factor = std::max(0.0, 1.0 - penalty * grp_wts / (ds_norm) );
-                thresh_factor = soft_threshold_mcp_norm(ds_norm, penalty * grp_wts, d, gamma);
-            }
-            if (thresh_factor != 0.0)
-            {
-                for (std::vector<int>::size_type v = 0; v < gr_idx.size(); ++v)
-                {
-                    int c_idx = gr_idx[v];
-                    res(c_idx) = vec(c_idx) * thresh_factor / d;
-                }
-            }
-        }
-    }
-    
-    static void block_soft_threshold(VectorXd &res, const VectorXd &vec, const double &penalty,
-                                     VectorXd &pen_fact, double &d,
-                                     std::vector<std::vector<int> > &grp_idx, 
-                                     const int &ngroups, VectorXi &unique_grps, VectorXi &grps)
-    {
-        //int v_size = vec.size();
-        res.setZero();
-        
-        for (int g = 0; g < ngroups; ++g) 
-        {
-            double thresh_factor;
-            std::vector<int> gr_idx = grp_idx[g];
-            
-            if (unique_grps(g) == 0) 
-            {
-                thresh_factor = 1.0;
-                
-            } else 
-            {
-                double ds_norm = 0.0;
-                for (std::vector<int>::size_type v = 0; v < gr_idx.size(); ++v)
-                {
-                    int c_idx = gr_idx[v];
-                    ds_norm += std::pow(vec(c_idx), 2);
-                }
-                ds_norm = std::sqrt(ds_norm);
-                // double grp_wts = sqrt(gr_idx.size());
-                double grp_wts = pen_fact(g);
-                thresh_factor = std::max(0.0, 1.0 - penalty * grp_wts / (ds_norm) );
-            }
-            if (thresh_factor != 0.0)
-            {
-                for (std::vector<int>::size_type v = 0; v < gr_idx.size(); ++v)
-                {
-                    int c_idx = gr_idx[v];
-                    res(c_idx) = vec(c_idx) * thresh_factor / d;
-                }
-            }
-        }
-    }
     
     /*
     MatrixXd XtWX() const {
@@ -332,64 +78,16 @@ protected:
     }*/
     
     MatrixXd XtWX() const {
-        
-        if (ncores <= 1)
-        {
-            return MatrixXd(nvars, nvars).setZero().selfadjointView<Lower>().
-            rankUpdate(X.adjoint() * (W.array().sqrt().matrix()).asDiagonal() );
-        } else 
-        {
-            MatrixXd XXtmp(nvars, nvars);
-            XXtmp.setZero();
-            
-            int numrowscurfirst = std::floor(double(nobs) / double(ncores));
-            
-            #pragma omp parallel
-            {
-                MatrixXd XXtmp_private(nvars, nvars);
-                XXtmp_private.setZero();
-                
-                // break up computation of X'X into 
-                // X'X = X_1'X_1 + ... + X_ncores'X_ncores
-                
-                #pragma omp for schedule(static) nowait
-                for (int ff = 0; ff < ncores; ++ff)
-                {
-                    
-                    if (ff + 1 == ncores)
-                    {
-                        int numrowscur = nobs - (ncores - 1) * std::floor(double(nobs) / double(ncores));
-                        
-                        XXtmp_private += MatrixXd(nvars, nvars).setZero().selfadjointView<Lower>().
-                        rankUpdate(X.bottomRows(numrowscur).adjoint() * 
-                        (W.tail(numrowscur).array().sqrt().matrix()).asDiagonal());
-                    } else 
-                    {
-                        XXtmp_private += MatrixXd(nvars, nvars).setZero().selfadjointView<Lower>().
-                        rankUpdate(X.middleRows(ff * numrowscurfirst, numrowscurfirst).adjoint() * 
-                        (W.segment(ff * numrowscurfirst, numrowscurfirst).array().sqrt().matrix()).asDiagonal());
-                    }
-                }
-                #pragma omp critical
-                {
-                    XXtmp += XXtmp_private; 
-                }
-                
-            }
-            return XXtmp;
-        }
+        // weights are applied inside the tiled product
+        MatrixXd XXtmp;
+        Linalg::gram_tiled(XXtmp, X, W.data(), ncores);
+        return XXtmp;
     }
     
     MatrixXd XWXt() const {
-        //if (standardize)
-        //{
-        //    return MatrixXd(nobs, nobs).setZero().selfadjointView<Lower>().
-        //    rankUpdate( (W.array().sqrt().matrix()).asDiagonal() * X * colsq_inv.asDiagonal() );
-        //} else 
-        //{
-        return MatrixXd(nobs, nobs).setZero().selfadjointView<Lower>().
-        rankUpdate( (W.array().sqrt().matrix()).asDiagonal() * X );
-        //}
+        MatrixXd XXtmp;
+        Linalg::outer_gram_weighted(XXtmp, X, W);
+        return XXtmp;
     }
     
     // function to be called once in the beginning
@@ -401,20 +99,7 @@ protected:
         if (penalty.find(grptxt) != std::string::npos) 
         {
             found_grp_idx = true;
-            grp_idx.reserve(ngroups);
-            for (int g = 0; g < ngroups; ++g) 
-            {
-                // find all variables in group number g
-                std::vector<int> idx_tmp;
-                for (int v = 0; v < nvars + int(intercept); ++v) 
-                {
-                    if (groups(v) == unique_groups(g)) 
-                    {
-                        idx_tmp.push_back(v);
-                    }
-                }
-                grp_idx[g] = idx_tmp;
-            }
+            grp_idx.build(groups, unique_groups, nvars + int(intercept));
             
             // if group weights were not specified,
             // then set the group weight for each
@@ -431,7 +116,7 @@ protected:
                         // penalty for group 0
                         group_weights(g) = 0;
                     } else {
-                        group_weights(g) = std::sqrt(double(grp_idx[g].size()));
+                        group_weights(g) = std::sqrt(double(grp_idx.size(g)));
                     }
                 }
             }
@@ -498,34 +183,41 @@ protected:
         // scale by sample size. needed for SCAD/MCP
         XX /= nobs;
         
-        Spectra::DenseSymMatProd<double> op(XX);
-        
-        int ncv = 4;
-        if (XX.cols() < 4)
-        {
-            ncv = XX.cols();
-        }
-        
-        Spectra::SymEigsSolver< double, Spectra::LARGEST_ALGE, Spectra::DenseSymMatProd<double> > eigs(&op, 1, ncv);
-        
-        eigs.init();
-        eigs.compute(1000, 1e-6);
-        Vector eigenvals = eigs.eigenvalues();
-        d = eigenvals[0] * 1.0005; // multiply by an increasing factor to be safe
-        
-        if (nobs > nvars + int(intercept))
-        {
-            A = -XX;
-            A.diagonal().array() += d;
+        // XX moved from the previous IRLS step's by X'(W - W_eig)X / n,
+        // or by W^1/2 XX' W^1/2 - W_eig^1/2 XX' W_eig^1/2 over n when 
+        // p >= n. its norm is at most the trace of the unweighted XX 
+        // over n times max |W - W_eig|, or for p >= n times 
+        // max |sqrt(W) - sqrt(W_eig)| * (max sqrt(W) + max sqrt(W_eig)), 
+        // and Weyl's inequality turns that into a bound for d
+        double bound = std::numeric_limits<double>::infinity();
+        if (W_eig.size() == nobs)
+        {
+            double wdiff;
+            if (nobs > nvars + int(intercept))
+            {
+                wdiff = (W - W_eig).cwiseAbs().maxCoeff();
+            } else 
+            {
+                wdiff = (W.array().sqrt() - W_eig.array().sqrt()).abs().maxCoeff() * 
+                        (W.array().sqrt().maxCoeff() + W_eig.array().sqrt().maxCoeff());
+            }
+            bound = eig_val + wdiff * xx_trace / double(nobs);
         }
         
+        // warm started from the leading eigenvector of
+        // the previous IRLS step's X'WX.
+        // multiply by an increasing factor to be safe
+        d = max_eigenvalue_warm(XX, 1.0005, bound);
+        W_eig = W;
     }
     
     void next_u(Vector &res)
     {
         if (nobs > nvars + int(intercept))
         {
-            res.noalias() = A * beta_prev + XY;
+            res = XY;
+            res.noalias() += d * beta_prev;
+            Linalg::sym_mat_vec_prod(res, XX, beta_prev, -1.0, 1.0);
         } else 
         {
             if (intercept)
@@ -566,112 +258,6 @@ protected:
         }
     }
     
-    void next_beta(Vector &res)
-    {
-        if (penalty == "lasso")
-        {
-            soft_threshold(beta, u, lambda, penalty_factor, d);
-        } else if (penalty == "ols")
-        {
-            beta = u / d;
-        } else if (penalty == "elastic.net")
-        {
-            double denom = d + (1.0 - alpha) * lambda;
-            double lam = lambda * alpha;
-            
-            soft_threshold(beta, u, lam, penalty_factor, denom);
-        } else if (penalty == "scad") 
-        {
-            soft_threshold_scad(beta, u, lambda, penalty_factor, d, gamma);
-            
-        } else if (penalty == "scad.net") 
-        {
-            double denom = d + (1.0 - alpha) * lambda;
-            double lam = lambda * alpha;
-            
-            if (alpha == 0)
-            {
-                lam   = 0;
-                denom = d + lambda;
-            }
-            
-            soft_threshold_scad(beta, u, lam, penalty_factor, denom, gamma);
-            
-        } else if (penalty == "mcp") 
-        {
-            soft_threshold_mcp(beta, u, lambda, penalty_factor, d, gamma);
-        } else if (penalty == "mcp.net") 
-        {
-            double denom = d + (1.0 - alpha) * lambda;
-            double lam = lambda * alpha;
-            
-            soft_threshold_mcp(beta, u, lam, penalty_factor, denom, gamma);
-            
-        } else if (penalty == "grp.lasso")
-        {
-            block_soft_threshold(beta, u, lambda, group_weights,
-                                 d, grp_idx, ngroups, 
-                                 unique_groups, groups);
-        } else if (penalty == "grp.lasso.net")
-        {
-            double denom = d + (1.0 - alpha) * lambda;
-            double lam = lambda * alpha;
-            
-            block_soft_threshold(beta, u, lam, group_weights,
-                                 denom, grp_idx, ngroups, 
-                                 unique_groups, groups);
-            
-        } else if (penalty == "grp.mcp")
-        {
-            block_soft_threshold_mcp(beta, u, lambda, group_weights,
-                                     d, grp_idx, ngroups, 
-                                     unique_groups, groups, gamma);
-        } else if (penalty == "grp.scad")
-        {
-            block_soft_threshold_scad(beta, u, lambda, group_weights,
-                                      d, grp_idx, ngroups, 
-                                      unique_groups, groups, gamma);
-        } else if (penalty == "grp.mcp.net")
-        {
-            double denom = d + (1.0 - alpha) * lambda;
-            double lam = lambda * alpha;
-            
-            
-            block_soft_threshold_mcp(beta, u, lam, group_weights,
-                                     denom, grp_idx, ngroups, 
-                                     unique_groups, groups, gamma);
-        } else if (penalty == "grp.scad.net")
-        {
-            double denom = d + (1.0 - alpha) * lambda;
-            double lam = lambda * alpha;
-            
-            block_soft_threshold_scad(beta, u, lam, group_weights,
-                                      denom, grp_idx, ngroups, 
-                                      unique_groups, groups, gamma);
-        } else if (penalty == "sparse.grp.lasso")
-        {
-            double lam_grp = (1.0 - tau) * lambda;
-            double lam_l1  = tau * lambda;
-            
-            double fact = 1.0;
-            
-            // first apply soft thresholding
-            // but don't divide by d
-            soft_threshold(beta, u, lam_l1, penalty_factor, fact);
-            
-            VectorXd beta_tmp = beta;
-            
-            // then apply block soft thresholding
-            block_soft_threshold(beta, beta_tmp, lam_grp, 
-                                 group_weights,
-                                 d, grp_idx, ngroups, 
-                                 unique_groups, groups);
-        }
-        
-        
-    }
-    
-    
 public:
     oemLogisticDense(const Eigen::Ref<const MatrixXd>  &X_, 
                      ConstGenericVector &Y_,
@@ -689,7 +275,10 @@ public:
                      const double tol_ = 1e-6) :
     oemBase<Eigen::VectorXd>(X_.rows(), 
                              X_.cols(),
-                             unique_groups_.size(),
+                             groups_,
+                             unique_groups_,
+                             group_weights_,
+                             penalty_factor_,
                              intercept_, 
                              standardize_,
                              tol_),
@@ -699,23 +288,17 @@ public:
                              prob(X_.rows()),
                              grad(X_.cols() + int(intercept_)),
                              weights(weights_),
-                             groups(groups_),
-                             unique_groups(unique_groups_),
-                             penalty_factor(penalty_factor_),
-                             group_weights(group_weights_),
                              penalty_factor_size(penalty_factor_.size()),
                              XXdim( std::min(X_.cols() + int(intercept_) , X_.rows())),
                              XY(X_.cols() + int(intercept)), // add extra space if intercept but no standardize
                              XX(XXdim, XXdim),                                // add extra space if intercept but no standardize
-                             default_group_weights( bool(group_weights_.size() < 1) ),  // compute default weights if none given
                              ncores(ncores_),
                              hessian_type(hessian_type_),
                              irls_maxit(irls_maxit_),
                              irls_tol(irls_tol_),
                              colsums(X_.cols()),
                              colsq(X_.cols()),
-                             colsq_inv(X_.cols()),
-                             grp_idx(unique_groups_.size())
+                             colsq_inv(X_.cols())
     {}
     
     void init_oem()
@@ -789,6 +372,21 @@ public:
         }
         
         XY /= nobs;
+        
+        // the trace of X'X, with the intercept and standardization 
+        // as in compute_XtX_d_update_A(), or of XX' if p >= n
+        W_eig.resize(0);
+        if (nobs > nvars + int(intercept) && standardize)
+        {
+            xx_trace = (X.colwise().squaredNorm().transpose().array() * colsq_inv.array().square()).sum();
+        } else 
+        {
+            xx_trace = X.squaredNorm();
+        }
+        if (nobs > nvars + int(intercept) && intercept)
+        {
+            xx_trace += double(nobs);
+        }
     }
     
     double compute_lambda_zero() 
@@ -803,7 +401,6 @@ public:
         }
         return lambda0; 
     }
-    double get_d() { return d; }
     
     // init() is a cold start for the first lambda
     void init(double lambda_, std::string penalty_,
@@ -819,7 +416,7 @@ public:
         }
         
         lambda = lambda_;
-        penalty = penalty_;
+        set_penalty(penalty_);
 
         alpha = alpha_;
         gamma = gamma_;
@@ -850,7 +447,6 @@ public:
         dev = 1e30;
         
         int i;
-        int j;
         for (i = 0; i < irls_maxit; ++i)
         {
             
@@ -1006,19 +602,7 @@ public:
             //}
             
             // oem iterations
-            for(j = 0; j < maxit; ++j)
-            {
-                
-                beta_prev = beta;
-                
-                update_u();
-                
-                update_beta();
-                
-                if(converged())
-                    break;
-                
-            }
+            run_oem(maxit);
             
             // update deviance residual
             dev = sum_dev_resid(Y, prob);
@@ -0,0 +1,405 @@
+#ifndef OEM_PENALTY_H
+#define OEM_PENALTY_H
+
+#include "utils.h"
+#include <unordered_map>
+
+
+// the members of every group, stored contiguously: the 
+// members of group g are idx[ptr[g]], ..., idx[ptr[g + 1] - 1]
+// in increasing order. the thresholding steps walk idx directly
+// instead of one heap allocated vector per group
+struct GroupIndex
+{
+    std::vector<int> ptr;       // offset of the first member of each group in idx
+    std::vector<int> idx;       // indexes of the members, group by group
+    
+    // group g of coefficient v is the g with unique_groups(g) == groups(v).
+    // coefficients in none of unique_groups are left out. O(nvars)
+    void build(const VectorXi &groups, const VectorXi &unique_groups, int nvars)
+    {
+        const int ngroups = unique_groups.size();
+        
+        std::unordered_map<int, int> group_pos;
+        group_pos.reserve(ngroups);
+        for (int g = 0; g < ngroups; ++g)
+        {
+            group_pos[unique_groups(g)] = g;
+        }
+        
+        // group of each coefficient, -1 if none
+        std::vector<int> var_group(nvars, -1);
+        ptr.assign(ngroups + 1, 0);
+        for (int v = 0; v < nvars; ++v)
+        {
+            std::unordered_map<int, int>::const_iterator it = group_pos.find(groups(v));
+            if (it != group_pos.end())
+            {
+                var_group[v] = it->second;
+                ++ptr[it->second + 1];
+            }
+        }
+        
+        for (int g = 0; g < ngroups; ++g)
+        {
+            ptr[g + 1] += ptr[g];
+        }
+        
+        idx.resize(ptr[ngroups]);
+        std::vector<int> next(ptr.begin(), ptr.end() - 1);
+        for (int v = 0; v < nvars; ++v)
+        {
+            if (var_group[v] >= 0)
+            {
+                idx[next[var_group[v]]++] = v;
+            }
+        }
+    }
+    
+    int size(int g) const { return ptr[g + 1] - ptr[g]; }
+    const int *begin(int g) const { return idx.data() + ptr[g]; }
+    const int *end(int g) const { return idx.data() + ptr[g + 1]; }
+};
+
+
+// quantities the thresholding step of oem depends on.
+// these are fixed for the duration of one call to solve()
+struct PenaltyParams
+{
+    double lambda;              // L1 penalty
+    double alpha;               // alpha = mixing parameter for elastic net
+    double gamma;               // extra tuning parameter for mcp/scad
+    double tau;                 // mixing parameter for group sparse penalties
+    double d;                   // d value (largest eigenvalue of X'X)
+    const VectorXd &penalty_factor;                  // penalty multiplication factors
+    const VectorXd &group_weights;                   // group lasso penalty multiplication factors
+    const GroupIndex &grp_idx;                       // indexes for all members of each group
+    const VectorXi &unique_groups;                   // vector of all unique groups
+    int ngroups;                                     // number of groups
+};
+
+
+/*
+ * thresholding kernels
+ */
+
+inline void soft_threshold(VectorXd &res, const VectorXd &vec, const double &penalty,
+                           const VectorXd &pen_fact, const double &d)
+{
+    int v_size = vec.size();
+    res.setZero();
+
+    const double *ptr = vec.data();
+    for(int i = 0; i < v_size; i++)
+    {
+        double total_pen = pen_fact(i) * penalty;
+
+        if(ptr[i] > total_pen)
+            res(i) = (ptr[i] - total_pen)/d;
+        else if(ptr[i] < -total_pen)
+            res(i) = (ptr[i] + total_pen)/d;
+    }
+}
+
+inline void soft_threshold_mcp(VectorXd &res, const VectorXd &vec, const double &penalty,
+                               const VectorXd &pen_fact, const double &d, const double &gamma)
+{
+    int v_size = vec.size();
+    res.setZero();
+    double gammad = gamma * d;
+    double d_minus_gammainv = d - 1.0 / gamma;
+
+
+    const double *ptr = vec.data();
+    for(int i = 0; i < v_size; i++)
+    {
+        double total_pen = pen_fact(i) * penalty;
+
+        if (std::abs(ptr[i]) > gammad * total_pen)
+            res(i) = ptr[i]/d;
+        else if(ptr[i] > total_pen)
+            res(i) = (ptr[i] - total_pen)/(d_minus_gammainv);
+        else if(ptr[i] < -total_pen)
+            res(i) = (ptr[i] + total_pen)/(d_minus_gammainv);
+
+    }
+
+}
+
+inline void soft_threshold_scad(VectorXd &res, const VectorXd &vec, const double &penalty,
+                                const VectorXd &pen_fact, const double &d, const double &gamma)
+{
+    int v_size = vec.size();
+    res.setZero();
+    double gammad = gamma * d;
+    double gamma_minus1_d = (gamma - 1.0) * d;
+
+    const double *ptr = vec.data();
+    for(int i = 0; i < v_size; i++)
+    {
+        double total_pen = pen_fact(i) * penalty;
+
+        if (std::abs(ptr[i]) > gammad * total_pen)
+            res(i) = ptr[i]/d;
+        else if (std::abs(ptr[i]) > (d + 1.0) * total_pen)
+        {
+            double gam_ptr = (gamma - 1.0) * ptr[i];
+            double gam_pen = gamma * total_pen;
+            if(gam_ptr > gam_pen)
+                res(i) = (gam_ptr - gam_pen)/(gamma_minus1_d - 1.0);
+            else if(gam_ptr < -gam_pen)
+                res(i) = (gam_ptr + gam_pen)/(gamma_minus1_d - 1.0);
+        }
+        else if(ptr[i] > total_pen)
+            res(i) = (ptr[i] - total_pen)/d;
+        else if(ptr[i] < -total_pen)
+            res(i) = (ptr[i] + total_pen)/d;
+
+    }
+}
+
+inline double soft_threshold_scad_norm(const double &b, const double &pen, const double &d, const double &gamma)
+{
+    double retval = 0.0;
+
+    double gammad = gamma * d;
+    double gamma_minus1_d = (gamma - 1.0) * d;
+
+    if (std::abs(b) > gammad * pen)
+        retval = 1.0;
+    else if (std::abs(b) > (d + 1.0) * pen)
+    {
+        double gam_ptr = (gamma - 1.0);
+        double gam_pen = gamma * pen / b;
+        if(gam_ptr > gam_pen)
+            retval = d * (gam_ptr - gam_pen)/(gamma_minus1_d - 1.0);
+        else if(gam_ptr < -gam_pen)
+            retval = d * (gam_ptr + gam_pen)/(gamma_minus1_d - 1.0);
+    }
+    else if(b > pen)
+        retval = (1.0 - pen / b);
+    else if(b < -pen)
+        retval = (1.0 + pen / b);
+    return retval;
+}
+
+inline double soft_threshold_mcp_norm(const double &b, const double &pen, const double &d, const double &gamma)
+{
+    double retval = 0.0;
+
+    double gammad = gamma * d;
+    double d_minus_gammainv = d - 1.0 / gamma;
+
+    if (std::abs(b) > gammad * pen)
+        retval = 1.0;
+    else if(b > pen)
+        retval = d * (1.0 - pen / b)/(d_minus_gammainv);
+    else if(b < -pen)
+        retval = d * (1.0 + pen / b)/(d_minus_gammainv);
+
+    return retval;
+}
+
+// group thresholding. GroupNorm maps the norm of a
+// group of u to the factor that group is scaled by
+// (before dividing by d)
+template <typename GroupNorm>
+inline void block_threshold(VectorXd &res, const VectorXd &vec, const double &penalty,
+                            const VectorXd &pen_fact, const double &d,
+                            const GroupIndex &grp_idx,
+                            const int &ngroups, const VectorXi &unique_grps,
+                            const double &gamma)
+{
+    res.setZero();
+
+    const double *vec_ptr = vec.data();
+    double *res_ptr = res.data();
+
+    for (int g = 0; g < ngroups; ++g)
+    {
+        double thresh_factor;
+        const int *gr_begin = grp_idx.begin(g);
+        const int *gr_end   = grp_idx.end(g);
+
+        if (unique_grps(g) == 0) // the 0 group represents unpenalized variables
+        {
+            thresh_factor = 1.0;
+        } else
+        {
+            double ds_norm = 0.0;
+            for (const int *c_idx = gr_begin; c_idx != gr_end; ++c_idx)
+            {
+                ds_norm += vec_ptr[*c_idx] * vec_ptr[*c_idx];
+            }
+            ds_norm = std::sqrt(ds_norm);
+            double grp_wts = pen_fact(g);
+            thresh_factor = GroupNorm::factor(ds_norm, penalty * grp_wts, d, gamma);
+        }
+        if (thresh_factor != 0.0)
+        {
+            const double scale = thresh_factor / d;
+            for (const int *c_idx = gr_begin; c_idx != gr_end; ++c_idx)
+            {
+                res_ptr[*c_idx] = vec_ptr[*c_idx] * scale;
+            }
+        }
+    }
+}
+
+struct GroupNormLasso
+{
+    static inline double factor(const double &b, const double &pen, const double &, const double &)
+    {
+        return std::max(0.0, 1.0 - pen / b);
+    }
+};
+
+struct GroupNormMcp
+{
+    static inline double factor(const double &b, const double &pen, const double &d, const double &gamma)
+    {
+        return soft_threshold_mcp_norm(b, pen, d, gamma);
+    }
+};
+
+struct GroupNormScad
+{
+    static inline double factor(const double &b, const double &pen, const double &d, const double &gamma)
+    {
+        return soft_threshold_scad_norm(b, pen, d, gamma);
+    }
+};
+
+
+/*
+ * proximal operator policies, one per penalty.
+ * the oem iterations are instantiated once per policy
+ * so the thresholding kernel is inlined into the loop
+ */
+
+struct ProxOls
+{
+    static inline void prox(VectorXd &beta, const VectorXd &u, const PenaltyParams &par)
+    {
+        beta = u / par.d;
+    }
+};
+
+struct ProxLasso
+{
+    static inline void prox(VectorXd &beta, const VectorXd &u, const PenaltyParams &par)
+    {
+        soft_threshold(beta, u, par.lambda, par.penalty_factor, par.d);
+    }
+};
+
+struct ProxElasticNet
+{
+    static inline void prox(VectorXd &beta, const VectorXd &u, const PenaltyParams &par)
+    {
+        double denom = par.d + (1.0 - par.alpha) * par.lambda;
+        double lam = par.lambda * par.alpha;
+
+        soft_threshold(beta, u, lam, par.penalty_factor, denom);
+    }
+};
+
+struct ProxScad
+{
+    static inline void prox(VectorXd &beta, const VectorXd &u, const PenaltyParams &par)
+    {
+        soft_threshold_scad(beta, u, par.lambda, par.penalty_factor, par.d, par.gamma);
+    }
+};
+
+struct ProxScadNet
+{
+    static inline void prox(VectorXd &beta, const VectorXd &u, const PenaltyParams &par)
+    {
+        double denom = par.d + (1.0 - par.alpha) * par.lambda;
+        double lam = par.lambda * par.alpha;
+
+        if (par.alpha == 0)
+        {
+            lam   = 0;
+            denom = par.d + par.lambda;
+        }
+
+        soft_threshold_scad(beta, u, lam, par.penalty_factor, denom, par.gamma);
+    }
+};
+
+struct ProxMcp
+{
+    static inline void prox(VectorXd &beta, const VectorXd &u, const PenaltyParams &par)
+    {
+        soft_threshold_mcp(beta, u, par.lambda, par.penalty_factor, par.d, par.gamma);
+    }
+};
+
+struct ProxMcpNet
+{
+    static inline void prox(VectorXd &beta, const VectorXd &u, const PenaltyParams &par)
+    {
+        double denom = par.d + (1.0 - par.alpha) * par.lambda;
+        double lam = par.lambda * par.alpha;
+
+        soft_threshold_mcp(beta, u, lam, par.penalty_factor, denom, par.gamma);
+    }
+};
+
+template <typename GroupNorm>
+struct ProxGroup
+{
+    static inline void prox(VectorXd &beta, const VectorXd &u, const PenaltyParams &par)
+    {
+        block_threshold<GroupNorm>(beta, u, par.lambda, par.group_weights,
+                                   par.d, par.grp_idx, par.ngroups,
+                                   par.unique_groups, par.gamma);
+    }
+};
+
+template <typename GroupNorm>
+struct ProxGroupNet
+{
+    static inline void prox(VectorXd &beta, const VectorXd &u, const PenaltyParams &par)
+    {
+        double denom = par.d + (1.0 - par.alpha) * par.lambda;
+        double lam = par.lambda * par.alpha;
+
+        block_threshold<GroupNorm>(beta, u, lam, par.group_weights,
+                                   denom, par.grp_idx, par.ngroups,
+                                   par.unique_groups, par.gamma);
+    }
+};
+
+struct ProxSparseGrpLasso
+{
+    static inline void prox(VectorXd &beta, const VectorXd &u, const PenaltyParams &par)
+    {
+        double lam_grp = (1.0 - par.tau) * par.lambda;
+        double lam_l1  = par.tau * par.lambda;
+
+        // first apply soft thresholding
+        // but don't divide by d
+        soft_threshold(beta, u, lam_l1, par.penalty_factor, 1.0);
+
+        VectorXd beta_tmp = beta;
+
+        // then apply block soft thresholding
+        block_threshold<GroupNormLasso>(beta, beta_tmp, lam_grp,
+                                        par.group_weights,
+                                        par.d, par.grp_idx, par.ngroups,
+                                        par.unique_groups, par.gamma);
+    }
+};
+
+typedef ProxGroup<GroupNormLasso>    ProxGrpLasso;
+typedef ProxGroup<GroupNormMcp>      ProxGrpMcp;
+typedef ProxGroup<GroupNormScad>     ProxGrpScad;
+typedef ProxGroupNet<GroupNormLasso> ProxGrpLassoNet;
+typedef ProxGroupNet<GroupNormMcp>   ProxGrpMcpNet;
+typedef ProxGroupNet<GroupNormScad>  ProxGrpScadNet;
+
+
+#endif // OEM_PENALTY_H
@@ -91,6 +91,10 @@ RcppExport SEXP oem_fit_sparse(SEXP x_,
     const int maxit        = as<int>(opts["maxit"]);
     int ncores             = as<int>(opts["ncores"]);
     const double tol       = as<double>(opts["tol"]);
+    const int aa_depth     = as<int>(opts["anderson_depth"]);
+    const bool screen      = as<bool>(opts["screen"]);
+    const int gap_freq     = as<int>(opts["gap_freq"]);
+    std::vector<std::string> stop_rule(as< std::vector<std::string> >(opts["stop.rule"]));
     const double alpha     = as<double>(alpha_);
     const double gamma     = as<double>(gamma_);
     const double tau       = as<double>(tau_);
@@ -102,11 +106,8 @@ RcppExport SEXP oem_fit_sparse(SEXP x_,
     std::vector<std::string> penalty(as< std::vector<std::string> >(penalty_));
     VectorXd penalty_factor(as<VectorXd>(penalty_factor_));
     
-    // take all threads but one
-    if (ncores < 1)
-    {
-        ncores = std::max(omp_get_num_threads() - 1, 1);
-    }
+    // ncores < 1 takes all threads but one
+    ncores = resolve_ncores(ncores);
     
     omp_set_num_threads(ncores);
     
@@ -122,19 +123,33 @@ RcppExport SEXP oem_fit_sparse(SEXP x_,
     
     // initialize pointers 
     oemBase<Eigen::VectorXd> *solver = NULL; // solver doesn't point to anything yet
+    oemSparse *sparse_solver = NULL;         // same solver, for fitting penalties concurrently
     
     // initialize class
     if (family(0) == "gaussian")
     {
-        solver = new oemSparse(X, Y, weights, groups, unique_groups, 
-                               group_weights, penalty_factor, 
-                               intercept, standardize, ncores, tol);
+        sparse_solver = new oemSparse(X, Y, weights, groups, unique_groups, 
+                                      group_weights, penalty_factor, 
+                                      intercept, standardize, ncores, tol);
+        solver = sparse_solver;
         
     } else if (family(0) == "binomial")
     {
         throw std::invalid_argument("binomial not available for oem_fit_sparse, use oem_fit_logistic_sparse");
     }
     
+    // safeguarded Anderson acceleration of the oem iterations
+    solver->set_anderson(aa_depth);
+    
+    // strong rule screening along the lambda path
+    solver->set_screen(screen);
+    
+    // check convergence with the duality gap where it is available
+    if (stop_rule[0] == "duality.gap")
+    {
+        solver->set_gap_freq(gap_freq);
+    }
+    
     // compute initial pieces of oem
     solver->init_oem();
     
@@ -168,87 +183,190 @@ RcppExport SEXP oem_fit_sparse(SEXP x_,
     
     std::string elasticnettxt(".net");
     
-    for (unsigned int pp = 0; pp < penalty.size(); pp++)
+    // with several penalties, fit them concurrently. each 
+    // thread has its own solver state for one penalty, 
+    // reading the X'X, X'Y and d of sparse_solver
+    const int npen = penalty.size();
+    const bool par_pen = (npen > 1 && ncores > 1 && sparse_solver != NULL &&
+                          sparse_solver->can_share_gram());
+    
+    if (par_pen)
     {
-        if (penalty[pp] == "ols")
-        {
-            nlambda = 1L;
-        }
-        
-        bool is_net_pen = penalty[pp].find(elasticnettxt) != std::string::npos;
+        std::vector<MatrixXd> beta_pen(npen, MatrixXd::Zero(p + 1, nlambda));
+        std::vector<VectorXd> loss_pen(npen);
+        std::vector<VectorXd> lambda_pen(npen);
+        std::vector<std::vector<int> > niter_pen(npen, std::vector<int>(nlambda));
         
-        if (provided_lambda)
+        for (int pp = 0; pp < npen; pp++)
         {
-            lambda_tmp = lambda[pp];
-        } else 
-        {
-            if (is_net_pen)
+            if (provided_lambda)
+            {
+                lambda_pen[pp] = lambda[pp];
+            } else if (penalty[pp].find(elasticnettxt) != std::string::npos)
             {
-                lambda_tmp = (lambda_base.array() / alpha).matrix(); // * n; // 
+                lambda_pen[pp] = (lambda_base.array() / alpha).matrix();
             } else
             {
-                lambda_tmp = lambda_base; // * n; // 
+                lambda_pen[pp] = lambda_base;
             }
         }
         
+        // errors can't leave the parallel region, so 
+        // they are collected and thrown after it
+        std::string pen_error;
         
-        VectorXd loss(nlambda);
-        loss.fill(1e99);
-        
-        for(int i = 0; i < nlambda; i++)
+        #pragma omp parallel for schedule(dynamic, 1) num_threads(std::min(ncores, npen))
+        for (int pp = 0; pp < npen; pp++)
         {
-            if (i % 3 == 0)
-            {
-                Rcpp::checkUserInterrupt();
-            }
+            const int nlambda_pen = (penalty[pp] == "ols") ? 1 : nlambda;
             
-            ilambda = lambda_tmp(i);
+            oemXTX *solver_pen = NULL;
             
-            if(i == 0)
-                solver->init(ilambda, penalty[pp],
-                             alpha, gamma, tau);
-            else
-                solver->init_warm(ilambda);
+            try
+            {
+                solver_pen = sparse_solver->gram_solver();
+                
+                loss_pen[pp].setConstant(nlambda_pen, 1e99);
+                
+                for (int i = 0; i < nlambda_pen; i++)
+                {
+                    if (i == 0)
+                        solver_pen->init(lambda_pen[pp](i), penalty[pp], alpha, gamma, tau);
+                    else
+                        solver_pen->init_warm(lambda_pen[pp](i));
+                    
+                    niter_pen[pp][i] = solver_pen->solve(maxit);
+                    VectorXd res = sparse_solver->unscale_beta(solver_pen->get_beta());
+                    
+                    // store beta estimates
+                    if (intercept)
+                    {
+                        beta_pen[pp].block(0, i, p + 1, 1) = res;
+                    } else 
+                    {
+                        beta_pen[pp].block(1, i, p, 1) = res;
+                    }
+                    
+                    if (compute_loss)
+                    {
+                        loss_pen[pp](i) = sparse_solver->get_loss(res);
+                    }
+                }
+            } catch (std::exception &e)
+            {
+                #pragma omp critical
+                pen_error = e.what();
+            }
             
-            niter[i] = solver->solve(maxit);
-            VectorXd res = solver->get_beta();
+            delete solver_pen;
+        }
+        
+        if (!pen_error.empty())
+        {
+            delete solver;
+            throw std::invalid_argument(pen_error);
+        }
+        
+        for (int pp = 0; pp < npen; pp++)
+        {
+            lambda[pp] = lambda_pen[pp];
             
-            // store beta estimates
-            if (intercept)
+            if (penalty[pp] == "ols")
             {
-                beta.block(0, i, p + 1, 1) = res;
+                beta_list(pp) = beta_pen[pp].col(0);
+                iter_list(pp) = niter_pen[pp][0];
+                loss_list(pp) = loss_pen[pp](0);
             } else 
             {
-                beta.block(1, i, p, 1) = res;
+                beta_list(pp) = beta_pen[pp];
+                iter_list(pp) = wrap(niter_pen[pp]);
+                loss_list(pp) = loss_pen[pp];
             }
-            
-            if (compute_loss)
+        }
+    } else
+    {
+        for (unsigned int pp = 0; pp < penalty.size(); pp++)
+        {
+            if (penalty[pp] == "ols")
             {
-                // get associated loss
-                loss(i) = solver->get_loss();
+                nlambda = 1L;
             }
+        
+            bool is_net_pen = penalty[pp].find(elasticnettxt) != std::string::npos;
+        
+            if (provided_lambda)
+            {
+                lambda_tmp = lambda[pp];
+            } else 
+            {
+                if (is_net_pen)
+                {
+                    lambda_tmp = (lambda_base.array() / alpha).matrix(); // * n; // 
+                } else
+                {
+                    lambda_tmp = lambda_base; // * n; // 
+                }
+            }
+        
+        
+            VectorXd loss(nlambda);
+            loss.fill(1e99);
+        
+            for(int i = 0; i < nlambda; i++)
+            {
+                if (i % 3 == 0)
+                {
+                    Rcpp::checkUserInterrupt();
+                }
             
+                ilambda = lambda_tmp(i);
             
-        } //end loop over lambda values
+                if(i == 0)
+                    solver->init(ilambda, penalty[pp],
+                                 alpha, gamma, tau);
+                else
+                    solver->init_warm(ilambda);
+            
+                niter[i] = solver->solve(maxit);
+                VectorXd res = solver->get_beta();
+            
+                // store beta estimates
+                if (intercept)
+                {
+                    beta.block(0, i, p + 1, 1) = res;
+                } else 
+                {
+                    beta.block(1, i, p, 1) = res;
+                }
+            
+                if (compute_loss)
+                {
+                    // get associated loss
+                    loss(i) = solver->get_loss();
+                }
+            
+            
+            } //end loop over lambda values
         
-        lambda[pp] = lambda_tmp;
+            lambda[pp] = lambda_tmp;
         
-        if (penalty[pp] == "ols")
-        {
-            // reset to old nlambda
-            nlambda = nlambda_store;
-            beta_list(pp) = beta.col(0);
-            iter_list(pp) = niter(0);
-            loss_list(pp) = loss(0);
-        } else 
-        {
-            beta_list(pp) = beta;
-            iter_list(pp) = niter;
-            loss_list(pp) = loss;
-        }
+            if (penalty[pp] == "ols")
+            {
+                // reset to old nlambda
+                nlambda = nlambda_store;
+                beta_list(pp) = beta.col(0);
+                iter_list(pp) = niter(0);
+                loss_list(pp) = loss(0);
+            } else 
+            {
+                beta_list(pp) = beta;
+                iter_list(pp) = niter;
+                loss_list(pp) = loss;
+            }
         
         
-    } // end loop over penalties
+        } // end loop over penalties
+    }
     
     double d = solver->get_d();
 
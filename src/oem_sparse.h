@@ -17,6 +17,7 @@
 #endif
 
 #include "oem_base.h"
+#include "oem_xtx.h"
 #include "Spectra/SymEigsSolver.h"
 #include "utils.h"
 
@@ -56,287 +57,22 @@ protected:
     const MSpMat X;             // sparse data matrix
     MapVec Y;                   // response vector
     VectorXd weights;
-    VectorXi groups;            // vector of group membersihp indexes 
-    VectorXi unique_groups;     // vector of all unique groups
-    VectorXd penalty_factor;    // penalty multiplication factors 
-    VectorXd group_weights;     // group lasso penalty multiplication factors 
     int penalty_factor_size;    // size of penalty_factor vector
     int XXdim;                  // dimension of XX (different if n > p and p >= n)
     Vector XY;                  // X'Y
     MatrixXd XX;                // X'X
-    MatrixXd A;                 // A = d * I - X'X
-    double d;                   // d value (largest eigenvalue of X'X)
-    bool default_group_weights; // do we need to compute default group weights?
     int ncores;
     double xxdiag;
     double intval;
     
     
-    std::vector<std::vector<int> > grp_idx; // vector of vectors of the indexes for all members of each group
-    std::string penalty;        // penalty specified
     
-    double lambda;              // L1 penalty
     double lambda0;             // minimum lambda to make coefficients all zero
-    double alpha;               // alpha = mixing parameter for elastic net
-    double gamma;               // extra tuning parameter for mcp/scad
-    double tau;                 // mixing parameter for group sparse penalties
     
     double threshval;
     int wt_len;
     
     VectorXd colsq_inv;
-    bool found_grp_idx;
-    
-    static void soft_threshold(VectorXd &res, const VectorXd &vec, const double &penalty, 
-                               VectorXd &pen_fact, double &d)
-    {
-        int v_size = vec.size();
-        res.setZero();
-        
-        const double *ptr = vec.data();
-        for(int i = 0; i < v_size; i++)
-        {
-            double total_pen = pen_fact(i) * penalty;
-            
-            if(ptr[i] > total_pen)
-                res(i) = (ptr[i] - total_pen)/d;
-            else if(ptr[i] < -total_pen)
-                res(i) = (ptr[i] + total_pen)/d;
-        }
-    }
-    
-    static void soft_threshold_mcp(VectorXd &res, const VectorXd &vec, const double &penalty, 
-                                   VectorXd &pen_fact, double &d, double &gamma)
-    {
-        int v_size = vec.size();
-        res.setZero();
-        double gammad = gamma * d;
-        double d_minus_gammainv = d - 1.0 / gamma;
-        
-        
-        const double *ptr = vec.data();
-        for(int i = 0; i < v_size; i++)
-        {
-            double total_pen = pen_fact(i) * penalty;
-            
-            if (std::abs(ptr[i]) > gammad * total_pen)
-                res(i) = ptr[i]/d;
-            else if(ptr[i] > total_pen)
-                res(i) = (ptr[i] - total_pen)/(d_minus_gammainv);
-            else if(ptr[i] < -total_pen)
-                res(i) = (ptr[i] + total_pen)/(d_minus_gammainv);
-            
-        }
-        
-    }
-    
-    static void soft_threshold_scad(VectorXd &res, const VectorXd &vec, const double &penalty, 
-                                    VectorXd &pen_fact, double &d, double &gamma)
-    {
-        int v_size = vec.size();
-        res.setZero();
-        double gammad = gamma * d;
-        double gamma_minus1_d = (gamma - 1.0) * d;
-        
-        const double *ptr = vec.data();
-        for(int i = 0; i < v_size; i++)
-        {
-            double total_pen = pen_fact(i) * penalty;
-            
-            if (std::abs(ptr[i]) > gammad * total_pen)
-                res(i) = ptr[i]/d;
-            else if (std::abs(ptr[i]) > (d + 1.0) * total_pen)
-            {
-                double gam_ptr = (gamma - 1.0) * ptr[i];
-                double gam_pen = gamma * total_pen;
-                if(gam_ptr > gam_pen)
-                    res(i) = (gam_ptr - gam_pen)/(gamma_minus1_d - 1.0);
-                else if(gam_ptr < -gam_pen)
-                    res(i) = (gam_ptr + gam_pen)/(gamma_minus1_d - 1.0);
-            }
-            else if(ptr[i] > total_pen)
-                res(i) = (ptr[i] - total_pen)/d;
-            else if(ptr[i] < -total_pen)
-                res(i) = (ptr[i] + total_pen)/d;
-            
-        }
-    }
-    
-    static double soft_threshold_scad_norm(double &b, const double &pen, double &d, double &gamma)
-    {
-        double retval = 0;
-        
-        double gammad = gamma * d;
-        double gamma_minus1_d = (gamma - 1.0) * d;
-        
-        if (std::abs(b) > gammad * pen)
-            retval = 1.0;
-        else if (std::abs(b) > (d + 1.0) * pen)
-        {
-            double gam_ptr = (gamma - 1.0);
-            double gam_pen = gamma * pen / b;
-            if(gam_ptr > gam_pen)
-                retval = d * (gam_ptr - gam_pen)/(gamma_minus1_d - 1.0);
-            else if(gam_ptr < -gam_pen)
-                retval = d * (gam_ptr + gam_pen)/(gamma_minus1_d - 1.0);
-        }
-        else if(b > pen)
-            retval = (1.0 - pen / b);
-        else if(b < -pen)
-            retval = (1.0 + pen / b);
-        return retval;
-    }
-    
-    static double soft_threshold_mcp_norm(double &b, const double &pen, double &d, double &gamma)
-    {
-        double retval = 0.0;
-        
-        double gammad = gamma * d;
-        double d_minus_gammainv = d - 1.0 / gamma;
-        
-        if (std::abs(b) > gammad * pen)
-            retval = 1.0;
-        else if(b > pen)
-            retval = d * (1.0 - pen / b)/(d_minus_gammainv);
-        else if(b < -pen)
-            retval = d * (1.0 + pen / b)/(d_minus_gammainv);
-        
-        return retval;
-    }
-    
-    static void block_soft_threshold_scad(VectorXd &res, const VectorXd &vec, const double &penalty,
-                                          VectorXd &pen_fact, double &d,
-                                          std::vector<std::vector<int> > &grp_idx, 
-                                          const int &ngroups, VectorXi &unique_grps, VectorXi &grps,
-                                          double & gamma)
-    {
-        //int v_size = vec.size();
-        res.setZero();
-        
-        for (int g = 0; g < ngroups; ++g) 
-        {
-            double thresh_factor;
-            std::vector<int> gr_idx = grp_idx[g];
-            
-            if (unique_grps(g) == 0) // the 0 group represents unpenalized variables
-            {
-                thresh_factor = 1.0;
-            } else 
-            {
-                double ds_norm = 0.0;
-                for (std::vector<int>::size_type v = 0; v < gr_idx.size(); ++v)
-                {
-                    int c_idx = gr_idx[v];
-                    ds_norm += std::pow(vec(c_idx), 2);
-                }
-                ds_norm = std::sqrt(ds_norm);
-                // double grp_wts = sqrt(gr_idx.size());
-                double grp_wts = pen_fact(g);
-                //thresh_factor = std::max(0.0, 1.0 - penalty * grp_wts / (ds_norm) );
-                thresh_factor = soft_threshold_scad_norm(ds_norm, penalty * grp_wts, d, gamma);
-            }
-            if (thresh_factor != 0.0)
-            {
-                for (std::vector<int>::size_type v = 0; v < gr_idx.size(); ++v)
-                {
-                    int c_idx = gr_idx[v];
-                    res(c_idx) = vec(c_idx) * thresh_factor / d;
-                }
-            }
-        }
-    }
-    
-    static void block_soft_threshold_mcp(VectorXd &res, const VectorXd &vec, const double &penalty,
-                                         VectorXd &pen_fact, double &d,
-                                         std::vector<std::vector<int> > &grp_idx, 
-                                         const int &ngroups, VectorXi &unique_grps, VectorXi &grps,
-                                         double & gamma)
-    {
-        //int v_size = vec.size();
-        res.setZero();
-        
-        for (int g = 0; g < ngroups; ++g) 
-        {
-            double thresh_factor;
-            std::vector<int> gr_idx = grp_idx[g];
-            
-            if (unique_grps(g) == 0) // the 0 group represents unpenalized variables
-            {
-                thresh_factor = 1.0;
-            } else 
-            {
-                double ds_norm = 0.0;
-                for (std::vector<int>::size_type v = 0; v < gr_idx.size(); ++v)
-                {
-                    int c_idx = gr_idx[v];
-                    ds_norm += std::pow(vec(c_idx), 2);
-                }
-                ds_norm = std::sqrt(ds_norm);
-                // double grp_wts = sqrt(gr_idx.size());
-                double grp_wts = pen_fact(g);
-                //thresh_factor = std::max(0.0, 1.0 - penalty * grp_wts / (ds_norm) );
-                thresh_factor = soft_threshold_mcp_norm(ds_norm, penalty * grp_wts, d, gamma);
-            }
-            if (thresh_factor != 0.0)
-            {
-                for (std::vector<int>::size_type v = 0; v < gr_idx.size(); ++v)
-                {
-                    int c_idx = gr_idx[v];
-                    res(c_idx) = vec(c_idx) * thresh_factor / d;
-                }
-            }
-        }
-    }
-    
-    static void block_soft_threshold(VectorXd &res, const VectorXd &vec, const double &penalty,
-                                     VectorXd &pen_fact, double &d,
-                                     std::vector<std::vector<int> > &grp_idx, 
-                                     const int &ngroups, VectorXi &unique_grps, VectorXi &grps)
-    {
-        //int v_size = vec.size();
-        res.setZero();
-        
-        for (int g = 0; g < ngroups; ++g) 
-        {
-            double thresh_factor;
-            std::vector<int> gr_idx = grp_idx[g];
-            /*
-            for (int v = 0; v < v_size; ++v) 
-            {
-                if (grps(v) == unique_grps(g)) 
-                {
-                    gr_idx.push_back(v);
-                }
-            }
-             */
-            if (unique_grps(g) == 0) 
-            {
-                thresh_factor = 1.0;
-            } else 
-            {
-                double ds_norm = 0.0;
-                for (std::vector<int>::size_type v = 0; v < gr_idx.size(); ++v)
-                {
-                    int c_idx = gr_idx[v];
-                    ds_norm += std::pow(vec(c_idx), 2);
-                }
-                ds_norm = std::sqrt(ds_norm);
-                // double grp_wts = sqrt(gr_idx.size());
-                double grp_wts = pen_fact(g);
-                thresh_factor = std::max(0.0, 1.0 - penalty * grp_wts / (ds_norm) );
-            }
-            if (thresh_factor != 0.0)
-            {
-                for (std::vector<int>::size_type v = 0; v < gr_idx.size(); ++v)
-                {
-                    int c_idx = gr_idx[v];
-                    res(c_idx) = vec(c_idx) * thresh_factor / d;
-                }
-            }
-        }
-    }
-    
-    
     
     SpMat XtX() const {
         return SpMat(XXdim, XXdim).selfadjointView<Upper>().
@@ -457,20 +193,7 @@ protected:
         if (penalty.find(grptxt) != std::string::npos) 
         {
             found_grp_idx = true;
-            grp_idx.reserve(ngroups);
-            for (int g = 0; g < ngroups; ++g) 
-            {
-                // find all variables in group number g
-                std::vector<int> idx_tmp;
-                for (int v = 0; v < groups.size(); ++v) 
-                {
-                    if (groups(v) == unique_groups(g)) 
-                    {
-                        idx_tmp.push_back(v);
-                    }
-                }
-                grp_idx[g] = idx_tmp;
-            }
+            grp_idx.build(groups, unique_groups, groups.size());
             
             // if group weights were not specified,
             // then set the group weight for each
@@ -481,7 +204,7 @@ protected:
                 group_weights.resize(ngroups);
                 for (int g = 0; g < ngroups; ++g) 
                 {
-                    group_weights(g) = std::sqrt(double(grp_idx[g].size()));
+                    group_weights(g) = std::sqrt(double(grp_idx.size(g)));
                 }
             }
         }
@@ -626,130 +349,49 @@ protected:
         eigs.compute(10000, 1e-10);
         Vector eigenvals = eigs.eigenvalues();
         d = eigenvals[0] * 1.005; // multiply by an increasing factor to be safe
-        
-        if (nobs > nvars)
-        {
-            A = -XX;
-            A.diagonal().array() += d;
-        }
     }
     
     void next_u(Vector &res)
     {
         if (nobs > nvars)
         {
-            res.noalias() = A * beta_prev + XY;
+            sparse_A_prod(res, XX, beta_prev, XY);
         } else 
         {
-            res.noalias() = X.adjoint() * (Y - X * beta_prev) / double(nobs) + d * beta_prev;
+            VectorXd resid(nobs);
+            sparse_design_prod(resid, X, beta_prev);
+            resid = Y - resid;
+            
+            screened_crossprod(res, X, resid);
+            res /= double(nobs);
+            res += d * beta_prev;
         }
     }
     
-    void next_beta(Vector &res)
+    double xy_dot(const VectorXd &b) const
     {
-        if (penalty == "lasso")
-        {
-            soft_threshold(beta, u, lambda, penalty_factor, d);
-        } else if (penalty == "ols")
-        {
-            beta = u / d;
-        } else if (penalty == "elastic.net")
-        {
-            double denom = d + (1.0 - alpha) * lambda;
-            double lam = lambda * alpha;
-            
-            soft_threshold(beta, u, lam, penalty_factor, denom);
-        } else if (penalty == "scad") 
-        {
-            soft_threshold_scad(beta, u, lambda, penalty_factor, d, gamma);
-            
-        } else if (penalty == "scad.net") 
-        {
-            double denom = d + (1.0 - alpha) * lambda;
-            double lam = lambda * alpha;
-            
-            if (alpha == 0)
-            {
-                lam   = 0;
-                denom = d + lambda;
-            }
-            
-            soft_threshold_scad(beta, u, lam, penalty_factor, denom, gamma);
-            
-        } else if (penalty == "mcp") 
-        {
-            soft_threshold_mcp(beta, u, lambda, penalty_factor, d, gamma);
-        } else if (penalty == "mcp.net") 
-        {
-            double denom = d + (1.0 - alpha) * lambda;
-            double lam = lambda * alpha;
-            
-            soft_threshold_mcp(beta, u, lam, penalty_factor, denom, gamma);
-            
-        } else if (penalty == "grp.lasso")
-        {
-            block_soft_threshold(beta, u, lambda, group_weights,
-                                 d, grp_idx, ngroups, 
-                                 unique_groups, groups);
-        } else if (penalty == "grp.lasso.net")
-        {
-            double denom = d + (1.0 - alpha) * lambda;
-            double lam = lambda * alpha;
-            
-            block_soft_threshold(beta, u, lam, group_weights,
-                                 denom, grp_idx, ngroups, 
-                                 unique_groups, groups);
-            
-        } else if (penalty == "grp.mcp")
-        {
-            block_soft_threshold_mcp(beta, u, lambda, group_weights,
-                                     d, grp_idx, ngroups, 
-                                     unique_groups, groups, gamma);
-        } else if (penalty == "grp.scad")
-        {
-            block_soft_threshold_scad(beta, u, lambda, group_weights,
-                                      d, grp_idx, ngroups, 
-                                      unique_groups, groups, gamma);
-        } else if (penalty == "grp.mcp.net")
-        {
-            double denom = d + (1.0 - alpha) * lambda;
-            double lam = lambda * alpha;
-            
-            
-            block_soft_threshold_mcp(beta, u, lam, group_weights,
-                                     denom, grp_idx, ngroups, 
-                                     unique_groups, groups, gamma);
-        } else if (penalty == "grp.scad.net")
-        {
-            double denom = d + (1.0 - alpha) * lambda;
-            double lam = lambda * alpha;
-            
-            block_soft_threshold_scad(beta, u, lam, group_weights,
-                                      denom, grp_idx, ngroups, 
-                                      unique_groups, groups, gamma);
-        } else if (penalty == "sparse.grp.lasso")
+        return b.dot(XY);
+    }
+    
+    bool next_u_delta(Vector &res, const Vector &delta)
+    {
+        if (nobs > nvars)
         {
-            double lam_grp = (1.0 - tau) * lambda;
-            double lam_l1  = tau * lambda;
-            
-            double fact = 1.0;
-            
-            // first apply soft thresholding
-            // but don't divide by d
-            soft_threshold(beta, u, lam_l1, penalty_factor, fact);
-            
-            VectorXd beta_tmp = beta;
-            
-            // then apply block soft thresholding
-            block_soft_threshold(beta, beta_tmp, lam_grp, 
-                                 group_weights,
-                                 d, grp_idx, ngroups, 
-                                 unique_groups, groups);
+            add_sparse_A_prod(res, XX, delta);
+            return true;
         }
-        
-        
+        return false;
     }
     
+    bool sub_gram(MatrixXd &xx_sub, VectorXd &xy_sub, const std::vector<int> &idx)
+    {
+        if (nobs > nvars)
+        {
+            sub_gram_from_XX(xx_sub, xy_sub, XX, XY, idx);
+            return true;
+        }
+        return false;
+    }
     
 public:
     oemSparse(const MSpMat &X_, 
@@ -765,24 +407,21 @@ public:
               const double tol_ = 1e-6) :
     oemBase<Eigen::VectorXd>(X_.rows(), 
                              X_.cols(),
-                             unique_groups_.size(),
+                             groups_,
+                             unique_groups_,
+                             group_weights_,
+                             penalty_factor_,
                              intercept_, 
                              standardize_,
                              tol_),
                              X(X_),
                              Y(Y_.data(), Y_.size()),
                              weights(weights_),
-                             groups(groups_),
-                             unique_groups(unique_groups_),
-                             penalty_factor(penalty_factor_),
-                             group_weights(group_weights_),
                              penalty_factor_size(penalty_factor_.size()),
                              XXdim( std::min(X_.cols(), X_.rows()) + intercept_ * (X_.rows() > X_.cols()) ),
                              XY(XXdim),            // add extra space if intercept and n > p
                              XX(XXdim, XXdim),     // add extra space if intercept and n > p
-                             default_group_weights(bool(group_weights_.size() < 1)), // compute default weights if none given
                              ncores(ncores_),
-                             grp_idx(unique_groups_.size()),
                              colsq_inv(X_.cols())
     
     {}
@@ -845,6 +484,9 @@ public:
         
         XY /= nobs;
         
+        // Y'Y for the duality gap
+        yty = (wt_len ? (Y.array().square() * weights.array()).sum() : Y.squaredNorm()) / nobs;
+        
     }
     
     double compute_lambda_zero() 
@@ -860,7 +502,6 @@ public:
         
         return lambda0; 
     }
-    double get_d() { return d; }
     
     // init() is a cold start for the first lambda
     void init(double lambda_, std::string penalty_,
@@ -869,7 +510,7 @@ public:
         beta.setZero();
         
         lambda = lambda_;
-        penalty = penalty_;
+        set_penalty(penalty_);
         
         alpha = alpha_;
         gamma = gamma_;
@@ -891,27 +532,12 @@ public:
         
     }
     
+    // coefficients on the original scale. beta itself is 
+    // left alone, so repeated calls and warm starts along 
+    // the path see the same state as a gram_solver() fit
     VectorXd get_beta() 
     { 
-        if (intercept && nobs > nvars)
-        {
-            beta(0) *= (intval);
-        }
-        if (standardize)
-        {
-            if (intercept)
-            {
-                VectorXd beta_tmp = beta;
-                beta_tmp.tail(nvars).array() *= colsq_inv.array();
-                return beta_tmp;
-            } else 
-            {
-                return (beta.array() * colsq_inv.array()).matrix();
-            }
-        } else 
-        {
-            return beta;
-        }
+        return unscale_beta(beta);
     }
     
     virtual double get_loss()
@@ -938,6 +564,68 @@ public:
         }
         return loss;
     }
+    
+    // the loss at coefficients coef on the 
+    // original scale, as given by get_beta()
+    double get_loss(const VectorXd &coef) const
+    {
+        double loss;
+        if (intercept)
+        {
+            loss = ((Y - X * coef.tail(nvars)).array() - coef(0)).array().square().sum();
+        } else 
+        {
+            loss = (Y - X * coef).array().square().sum();
+        }
+        return loss;
+    }
+    
+    // coefficients on the original scale for a 
+    // solution b of the problem held in X'X
+    VectorXd unscale_beta(VectorXd b) const
+    {
+        if (intercept && nobs > nvars)
+        {
+            b(0) *= intval;
+        }
+        if (standardize)
+        {
+            if (intercept)
+            {
+                b.tail(nvars).array() *= colsq_inv.array();
+            } else 
+            {
+                b.array() *= colsq_inv.array();
+            }
+        }
+        return b;
+    }
+    
+    // whether gram_solver() is available
+    bool can_share_gram() const
+    {
+        return (nobs > nvars);
+    }
+    
+    // a solver for the same problem that reads this solver's 
+    // X'X, d and options, so that penalties can be fit on 
+    // separate threads without copying X'X. its solutions are 
+    // put on the original scale with unscale_beta(). init_oem() 
+    // must have been called and can_share_gram() must hold. 
+    // the caller owns the returned solver
+    oemXTX *gram_solver() const
+    {
+        VectorXd group_weights_seg(group_weights);
+        VectorXd penalty_factor_seg(penalty_factor);
+        VectorXd scale_factor_seg(0);
+        
+        oemXTX *solver_seg = new oemXTX(XX, XY, groups, unique_groups,
+                                        group_weights_seg, penalty_factor_seg,
+                                        scale_factor_seg, tol);
+        solver_seg->copy_options(*this);
+        solver_seg->init_oem(d);
+        return solver_seg;
+    }
 };
 
 
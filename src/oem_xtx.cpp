@@ -1,5 +1,6 @@
 
 #include "oem_xtx.h"
+#include "oem_xtx_stream.h"
 
 using Eigen::MatrixXf;
 using Eigen::VectorXf;
@@ -26,8 +27,14 @@ typedef Eigen::SparseVector<double> SpVec;
 typedef Eigen::SparseMatrix<double> SpMat;
 
 
-RcppExport SEXP oem_xtx(SEXP xtx_, 
-                        SEXP xty_, 
+// fits the path from X'X / n and X'Y / n, for oem_xtx, or from 
+// the sums X'X, X'Y and Y'Y over nobs rows accumulated by 
+// oem_xtx_stream. yty is negative when Y'Y is not known, 
+// and the duality gap can't be used then
+static List oem_xtx_fit(const Eigen::Ref<const MatrixXd> &xtx, 
+                        const Eigen::Ref<const VectorXd> &xty, 
+                        double nobs,
+                        double yty,
                         SEXP family_,
                         SEXP penalty_,
                         SEXP groups_,
@@ -43,11 +50,6 @@ RcppExport SEXP oem_xtx(SEXP xtx_,
                         SEXP penalty_factor_,
                         SEXP opts_)
 {
-    BEGIN_RCPP
-    
-    const MapMatd xtx(as<MapMatd >(xtx_));
-    const MapVecd xty(as<MapVecd >(xty_));
-    
     const int p = xtx.cols();
     
     const VectorXd scale_factor(as<VectorXd>(scale_factor_));
@@ -77,10 +79,19 @@ RcppExport SEXP oem_xtx(SEXP xtx_,
     List opts(opts_);
     const int maxit        = as<int>(opts["maxit"]);
     const double tol       = as<double>(opts["tol"]);
+    const int aa_depth     = as<int>(opts["anderson_depth"]);
+    const bool screen      = as<bool>(opts["screen"]);
+    const int gap_freq     = as<int>(opts["gap_freq"]);
+    std::vector<std::string> stop_rule(as< std::vector<std::string> >(opts["stop.rule"]));
     const double alpha     = as<double>(alpha_);
     const double gamma     = as<double>(gamma_);
     const double tau       = as<double>(tau_);
     
+    if (stop_rule[0] == "duality.gap" && yty < 0.0)
+    {
+        throw std::invalid_argument("stop.rule = \"duality.gap\" needs Y'Y, which is only known for an xtx.stream");
+    }
+    
     CharacterVector family(as<CharacterVector>(family_));
     std::vector<std::string> penalty(as< std::vector<std::string> >(penalty_));
     VectorXd penalty_factor(as<VectorXd>(penalty_factor_));
@@ -96,13 +107,25 @@ RcppExport SEXP oem_xtx(SEXP xtx_,
     {
         solver = new oemXTX(xtx, xty, groups, unique_groups, 
                             group_weights, penalty_factor, 
-                            scale_factor, tol);
+                            scale_factor, tol, nobs, yty);
     } else if (family(0) == "binomial")
     {
         throw std::invalid_argument("binomial not available for oem_fit_dense, use oem_fit_logistic_dense");
         //solver = new oem(X, Y, penalty_factor, irls_tol, irls_maxit, eps_abs, eps_rel);
     }
     
+    // safeguarded Anderson acceleration of the oem iterations
+    solver->set_anderson(aa_depth);
+    
+    // strong rule screening along the lambda path
+    solver->set_screen(screen);
+    
+    // check convergence with the duality gap where it is available
+    if (stop_rule[0] == "duality.gap")
+    {
+        solver->set_gap_freq(gap_freq);
+    }
+    
     // initialize oem
     solver->init_oem();
     
@@ -215,6 +238,134 @@ RcppExport SEXP oem_xtx(SEXP xtx_,
                         Named("niter")  = iter_list,
                         Named("loss")   = loss_list,
                         Named("d")      = d);
+}
+
+
+RcppExport SEXP oem_xtx(SEXP xtx_, 
+                        SEXP xty_, 
+                        SEXP family_,
+                        SEXP penalty_,
+                        SEXP groups_,
+                        SEXP unique_groups_,
+                        SEXP group_weights_,
+                        SEXP lambda_,
+                        SEXP nlambda_, 
+                        SEXP lmin_ratio_,
+                        SEXP alpha_,
+                        SEXP gamma_,
+                        SEXP tau_,
+                        SEXP scale_factor_,
+                        SEXP penalty_factor_,
+                        SEXP opts_)
+{
+    BEGIN_RCPP
+    
+    const MapMatd xtx(as<MapMatd >(xtx_));
+    const MapVecd xty(as<MapVecd >(xty_));
+    
+    return oem_xtx_fit(xtx, xty, 1.0, -1.0, family_, penalty_, groups_, unique_groups_, 
+                       group_weights_, lambda_, nlambda_, lmin_ratio_, 
+                       alpha_, gamma_, tau_, scale_factor_, penalty_factor_, opts_);
+    END_RCPP
+}
+
+
+// a new accumulator of X'X, X'Y and the other sufficient 
+// statistics for nvars covariates, filled by oem_xtx_stream_add
+// and oem_xtx_stream_add_file
+RcppExport SEXP oem_xtx_stream_new(SEXP nvars_, SEXP ncores_)
+{
+    BEGIN_RCPP
+    
+    const int nvars = as<int>(nvars_);
+    int ncores      = as<int>(ncores_);
+    
+    // ncores < 1 takes all threads but one
+    ncores = resolve_ncores(ncores);
+    
+    XPtr<XTXAccumulator> acc(new XTXAccumulator(nvars, ncores), true);
+    return acc;
+    END_RCPP
+}
+
+
+RcppExport SEXP oem_xtx_stream_add(SEXP acc_, SEXP x_, SEXP y_, SEXP weights_)
+{
+    BEGIN_RCPP
+    
+    XPtr<XTXAccumulator> acc(acc_);
+    
+    const MapMatd x(as<MapMatd >(x_));
+    const MapVecd y(as<MapVecd >(y_));
+    const VectorXd weights(as<VectorXd>(weights_));
+    
+    acc->add_rows(x, y, weights);
+    
+    return wrap(acc->get_nobs());
+    END_RCPP
+}
+
+
+RcppExport SEXP oem_xtx_stream_add_file(SEXP acc_, SEXP file_, SEXP weighted_, SEXP chunk_rows_)
+{
+    BEGIN_RCPP
+    
+    XPtr<XTXAccumulator> acc(acc_);
+    
+    const std::string file = as<std::string>(file_);
+    const bool weighted    = as<bool>(weighted_);
+    const int chunk_rows   = as<int>(chunk_rows_);
+    
+    acc->add_file(file, weighted, chunk_rows);
+    
+    return wrap(acc->get_nobs());
+    END_RCPP
+}
+
+
+RcppExport SEXP oem_xtx_stream_stats(SEXP acc_)
+{
+    BEGIN_RCPP
+    
+    XPtr<XTXAccumulator> acc(acc_);
+    
+    return acc->get_stats();
     END_RCPP
 }
 
+
+// fits from the accumulated X'X and X'Y directly, 
+// without passing them back through R
+RcppExport SEXP oem_xtx_stream(SEXP acc_, 
+                               SEXP family_,
+                               SEXP penalty_,
+                               SEXP groups_,
+                               SEXP unique_groups_,
+                               SEXP group_weights_,
+                               SEXP lambda_,
+                               SEXP nlambda_, 
+                               SEXP lmin_ratio_,
+                               SEXP alpha_,
+                               SEXP gamma_,
+                               SEXP tau_,
+                               SEXP scale_factor_,
+                               SEXP penalty_factor_,
+                               SEXP opts_)
+{
+    BEGIN_RCPP
+    
+    XPtr<XTXAccumulator> acc(acc_);
+    
+    if (acc->get_nobs() < 1)
+    {
+        throw std::invalid_argument("no rows have been added to the xtx.stream");
+    }
+    
+    const MatrixXd &xtx = acc->get_xtx();
+    const VectorXd &xty = acc->get_xty();
+    
+    return oem_xtx_fit(xtx, xty, acc->get_nobs(), acc->get_yty(), family_, penalty_, groups_, unique_groups_, 
+                       group_weights_, lambda_, nlambda_, lmin_ratio_, 
+                       alpha_, gamma_, tau_, scale_factor_, penalty_factor_, opts_);
+    END_RCPP
+}
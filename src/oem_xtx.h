@@ -31,282 +31,21 @@ protected:
     const MapMatd XX;           // X'X matrix
     MapVec XY_init;             // X'Y vector
     VectorXd XY;                // X'Y vector
-    VectorXi groups;            // vector of group membersihp indexes 
-    VectorXi unique_groups;     // vector of all unique groups
-    VectorXd penalty_factor;    // penalty multiplication factors 
-    VectorXd group_weights;     // group lasso penalty multiplication factors 
     VectorXd scale_factor;      // scaling factor for columns of X
     VectorXd scale_factor_inv;  // inverse of scaling factor for columns of X
     int penalty_factor_size;    // size of penalty_factor vector
     
-    MatrixXd A;                 // A = d * I - X'X
-    double d;                   // d value (largest eigenvalue of X'X)
-    bool default_group_weights; // do we need to compute default group weights?
+    MatrixXd XX_scaled;         // X'X with scaling applied, only formed if scale_factor given
+    double xx_mult;             // multiplies XX and XY_init, 1 / nobs if they are sums
+    double yty_init;            // Y'Y on the scale of XY_init, negative if not known
 
     
-    std::vector<std::vector<int> > grp_idx; // vector of vectors of the indexes for all members of each group
-    std::string penalty;        // penalty specified
     
-    double lambda;              // L1 penalty
     double lambda0;             // minimum lambda to make coefficients all zero
-    double alpha;               // alpha = mixing parameter for elastic net
-    double gamma;               // extra tuning parameter for mcp/scad
-    double tau;                 // mixing parameter for group sparse penalties
     
     double threshval;
     int scale_len;
     
-    bool found_grp_idx;
-    
-    static void soft_threshold(VectorXd &res, const VectorXd &vec, const double &penalty, 
-                               VectorXd &pen_fact, double &d)
-    {
-        int v_size = vec.size();
-        res.setZero();
-        
-        const double *ptr = vec.data();
-        for(int i = 0; i < v_size; i++)
-        {
-            double total_pen = pen_fact(i) * penalty;
-            
-            if(ptr[i] > total_pen)
-                res(i) = (ptr[i] - total_pen)/d;
-            else if(ptr[i] < -total_pen)
-                res(i) = (ptr[i] + total_pen)/d;
-        }
-    }
-    
-    
-    static void soft_threshold_mcp(VectorXd &res, const VectorXd &vec, const double &penalty, 
-                                   VectorXd &pen_fact, double &d, double &gamma)
-    {
-        int v_size = vec.size();
-        res.setZero();
-        double gammad = gamma * d;
-        double d_minus_gammainv = d - 1.0 / gamma;
-        
-        
-        const double *ptr = vec.data();
-        for(int i = 0; i < v_size; i++)
-        {
-            double total_pen = pen_fact(i) * penalty;
-            
-            if (std::abs(ptr[i]) > gammad * total_pen)
-                res(i) = ptr[i]/d;
-            else if(ptr[i] > total_pen)
-                res(i) = (ptr[i] - total_pen)/(d_minus_gammainv);
-            else if(ptr[i] < -total_pen)
-                res(i) = (ptr[i] + total_pen)/(d_minus_gammainv);
-            
-        }
-        
-    }
-    
-    static void soft_threshold_scad(VectorXd &res, const VectorXd &vec, const double &penalty, 
-                                    VectorXd &pen_fact, double &d, double &gamma)
-    {
-        int v_size = vec.size();
-        res.setZero();
-        double gammad = gamma * d;
-        double gamma_minus1_d = (gamma - 1.0) * d;
-        
-        const double *ptr = vec.data();
-        for(int i = 0; i < v_size; i++)
-        {
-            double total_pen = pen_fact(i) * penalty;
-            
-            if (std::abs(ptr[i]) > gammad * total_pen)
-                res(i) = ptr[i]/d;
-            else if (std::abs(ptr[i]) > (d + 1.0) * total_pen)
-            {
-                double gam_ptr = (gamma - 1.0) * ptr[i];
-                double gam_pen = gamma * total_pen;
-                if(gam_ptr > gam_pen)
-                    res(i) = (gam_ptr - gam_pen)/(gamma_minus1_d - 1.0);
-                else if(gam_ptr < -gam_pen)
-                    res(i) = (gam_ptr + gam_pen)/(gamma_minus1_d - 1.0);
-            }
-            else if(ptr[i] > total_pen)
-                res(i) = (ptr[i] - total_pen)/d;
-            else if(ptr[i] < -total_pen)
-                res(i) = (ptr[i] + total_pen)/d;
-            
-        }
-    }
-    
-    static double soft_threshold_scad_norm(double &b, const double &pen, double &d, double &gamma)
-    {
-        double retval = 0.0;
-        
-        double gammad = gamma * d;
-        double gamma_minus1_d = (gamma - 1.0) * d;
-        
-        if (std::abs(b) > gammad * pen)
-            retval = 1.0;
-        else if (std::abs(b) > (d + 1.0) * pen)
-        {
-            double gam_ptr = (gamma - 1.0);
-            double gam_pen = gamma * pen / b;
-            if(gam_ptr > gam_pen)
-                retval = d * (gam_ptr - gam_pen)/(gamma_minus1_d - 1.0);
-            else if(gam_ptr < -gam_pen)
-                retval = d * (gam_ptr + gam_pen)/(gamma_minus1_d - 1.0);
-        }
-        else if(b > pen)
-            retval = (1.0 - pen / b);
-        else if(b < -pen)
-            retval = (1.0 + pen / b);
-        return retval;
-    }
-    
-    static double soft_threshold_mcp_norm(double &b, const double &pen, double &d, double &gamma)
-    {
-        double retval = 0.0;
-        
-        double gammad = gamma * d;
-        double d_minus_gammainv = d - 1.0 / gamma;
-        
-        if (std::abs(b) > gammad * pen)
-            retval = 1.0;
-        else if(b > pen)
-            retval = d * (1.0 - pen / b)/(d_minus_gammainv);
-        else if(b < -pen)
-            retval = d * (1.0 + pen / b)/(d_minus_gammainv);
-        
-        return retval;
-    }
-    
-    static void block_soft_threshold_scad(VectorXd &res, const VectorXd &vec, const double &penalty,
-                                          VectorXd &pen_fact, double &d,
-                                          std::vector<std::vector<int> > &grp_idx, 
-                                          const int &ngroups, VectorXi &unique_grps, VectorXi &grps,
-                                          double & gamma)
-    {
-        //int v_size = vec.size();
-        res.setZero();
-        
-        for (int g = 0; g < ngroups; ++g) 
-        {
-            double thresh_factor;
-            std::vector<int> gr_idx = grp_idx[g];
-            
-            if (unique_grps(g) == 0) // the 0 group represents unpenalized variables
-            {
-                thresh_factor = 1.0;
-            } else 
-            {
-                double ds_norm = 0.0;
-                for (std::vector<int>::size_type v = 0; v < gr_idx.size(); ++v)
-                {
-                    int c_idx = gr_idx[v];
-                    ds_norm += std::pow(vec(c_idx), 2);
-                }
-                ds_norm = std::sqrt(ds_norm);
-                // double grp_wts = sqrt(gr_idx.size());
-                double grp_wts = pen_fact(g);
-                //thresh_factor = std::max(0.0, 1.0 - penalty * grp_wts / (ds_norm) );
-                thresh_factor = soft_threshold_scad_norm(ds_norm, penalty * grp_wts, d, gamma);
-            }
-            if (thresh_factor != 0.0)
-            {
-                for (std::vector<int>::size_type v = 0; v < gr_idx.size(); ++v)
-                {
-                    int c_idx = gr_idx[v];
-                    res(c_idx) = vec(c_idx) * thresh_factor / d;
-                }
-            }
-        }
-    }
-    
-    static void block_soft_threshold_mcp(VectorXd &res, const VectorXd &vec, const double &penalty,
-                                         VectorXd &pen_fact, double &d,
-                                         std::vector<std::vector<int> > &grp_idx, 
-                                         const int &ngroups, VectorXi &unique_grps, VectorXi &grps,
-                                         double & gamma)
-    {
-        //int v_size = vec.size();
-        res.setZero();
-        
-        for (int g = 0; g < ngroups; ++g) 
-        {
-            double thresh_factor;
-            std::vector<int> gr_idx = grp_idx[g];
-            
-            if (unique_grps(g) == 0) // the 0 group represents unpenalized variables
-            {
-                thresh_factor = 1.0;
-            } else 
-            {
-                double ds_norm = 0.0;
-                for (std::vector<int>::size_type v = 0; v < gr_idx.size(); ++v)
-                {
-                    int c_idx = gr_idx[v];
-                    ds_norm += std::pow(vec(c_idx), 2);
-                }
-                ds_norm = std::sqrt(ds_norm);
-                // double grp_wts = sqrt(gr_idx.size());
-                double grp_wts = pen_fact(g);
-                //thresh_factor = std::max(0.0, 1.0 - penalty * grp_wts / (ds_norm) );
-                thresh_factor = soft_threshold_mcp_norm(ds_norm, penalty * grp_wts, d, gamma);
-            }
-            if (thresh_factor != 0.0)
-            {
-                for (std::vector<int>::size_type v = 0; v < gr_idx.size(); ++v)
-                {
-                    int c_idx = gr_idx[v];
-                    res(c_idx) = vec(c_idx) * thresh_factor / d;
-                }
-            }
-        }
-    }
-    
-    static void block_soft_threshold(VectorXd &res, const VectorXd &vec, const double &penalty,
-                                     VectorXd &pen_fact, double &d,
-                                     std::vector<std::vector<int> > &grp_idx, 
-                                     const int &ngroups, VectorXi &unique_grps, VectorXi &grps)
-    {
-        //int v_size = vec.size();
-        res.setZero();
-        
-        for (int g = 0; g < ngroups; ++g) 
-        {
-            double thresh_factor;
-            std::vector<int> gr_idx = grp_idx[g];
-            /*
-            for (int v = 0; v < v_size; ++v) 
-            {
-            if (grps(v) == unique_grps(g)) 
-            {
-            gr_idx.push_back(v);
-            }
-            }
-            */
-            if (unique_grps(g) == 0) 
-            {
-                thresh_factor = 1.0;
-            } else 
-            {
-                double ds_norm = 0.0;
-                for (std::vector<int>::size_type v = 0; v < gr_idx.size(); ++v)
-                {
-                    int c_idx = gr_idx[v];
-                    ds_norm += std::pow(vec(c_idx), 2);
-                }
-                ds_norm = std::sqrt(ds_norm);
-                // double grp_wts = sqrt(gr_idx.size());
-                double grp_wts = pen_fact(g);
-                thresh_factor = std::max(0.0, 1.0 - penalty * grp_wts / (ds_norm) );
-            }
-            if (thresh_factor != 0.0)
-            {
-                for (std::vector<int>::size_type v = 0; v < gr_idx.size(); ++v)
-                {
-                    int c_idx = gr_idx[v];
-                    res(c_idx) = vec(c_idx) * thresh_factor / d;
-                }
-            }
-        }
-    }
     
     void get_group_indexes()
     {
@@ -315,20 +54,7 @@ protected:
         if (penalty.find(grptxt) != std::string::npos)
         {
             found_grp_idx = true;
-            grp_idx.reserve(ngroups);
-            for (int g = 0; g < ngroups; ++g) 
-            {
-                // find all variables in group number g
-                std::vector<int> idx_tmp;
-                for (int v = 0; v < nvars; ++v) 
-                {
-                    if (groups(v) == unique_groups(g)) 
-                    {
-                        idx_tmp.push_back(v);
-                    }
-                }
-                grp_idx[g] = idx_tmp;
-            }
+            grp_idx.build(groups, unique_groups, nvars);
             // if group weights were not specified,
             // then set the group weight for each
             // group to be the sqrt of the size of the
@@ -338,22 +64,29 @@ protected:
                 group_weights.resize(ngroups);
                 for (int g = 0; g < ngroups; ++g) 
                 {
-                    group_weights(g) = std::sqrt(double(grp_idx[g].size()));
+                    group_weights(g) = std::sqrt(double(grp_idx.size(g)));
                 }
             }
         }
     }
     
-    void compute_XtX_d_update_A()
+    void compute_XtX_d_update_A(double d_known = 0.0)
     {
-        MatrixXd XXmat(XX.rows(), XX.cols());
+        // only copy X'X if it needs to be scaled. xx_mult
+        // is then applied to the copy rather than in every product
         if (scale_len)
         {
-            XXmat = scale_factor_inv.asDiagonal() * XX * scale_factor_inv.asDiagonal();
-        } else 
+            XX_scaled = (xx_mult * scale_factor_inv).asDiagonal() * XX * scale_factor_inv.asDiagonal();
+        }
+        
+        if (d_known > 0.0)
         {
-            XXmat = XX;
+            d = d_known;
+            return;
         }
+        
+        ConstGenericMatrix XXmat = gram();
+        
         Spectra::DenseSymMatProd<double> op(XXmat);
         int ncv = 4;
         if (XX.cols() < 4)
@@ -366,127 +99,53 @@ protected:
         eigs.init();
         eigs.compute(10000, 1e-10);
         Vector eigenvals = eigs.eigenvalues();
-        d = eigenvals[0] * 1.005; // multiply by an increasing factor to be safe
-        
-        A = -XXmat;
-        
-        
-        A.diagonal().array() += d;
-        
+        d = eigenvals[0] * gram_mult() * 1.005; // multiply by an increasing factor to be safe
+    }
+    
+    // the (possibly scaled) X'X used in the oem iterations
+    ConstGenericMatrix gram() const
+    {
+        if (scale_len)
+        {
+            return XX_scaled;
+        } 
+        return XX;
+    }
+    
+    // the multiplier of gram() in the oem iterations
+    double gram_mult() const
+    {
+        return scale_len ? 1.0 : xx_mult;
     }
     
     void next_u(Vector &res)
     {
-        res.noalias() = A * beta_prev + XY;
+        sparse_A_prod(res, gram(), beta_prev, XY, gram_mult());
     }
     
-    void next_beta(Vector &res)
+    double xy_dot(const VectorXd &b) const
     {
-        if (penalty == "lasso")
-        {
-            soft_threshold(beta, u, lambda, penalty_factor, d);
-        } else if (penalty == "ols")
-        {
-            beta = u / d;
-        } else if (penalty == "elastic.net")
-        {
-            double denom = d + (1.0 - alpha) * lambda;
-            double lam = lambda * alpha;
-            
-            soft_threshold(beta, u, lam, penalty_factor, denom);
-        } else if (penalty == "scad") 
-        {
-            soft_threshold_scad(beta, u, lambda, penalty_factor, d, gamma);
-            
-        } else if (penalty == "scad.net") 
-        {
-            double denom = d + (1.0 - alpha) * lambda;
-            double lam = lambda * alpha;
-            
-            if (alpha == 0)
-            {
-                lam   = 0;
-                denom = d + lambda;
-            }
-            
-            soft_threshold_scad(beta, u, lam, penalty_factor, denom, gamma);
-            
-        } else if (penalty == "mcp") 
-        {
-            soft_threshold_mcp(beta, u, lambda, penalty_factor, d, gamma);
-        } else if (penalty == "mcp.net") 
-        {
-            double denom = d + (1.0 - alpha) * lambda;
-            double lam = lambda * alpha;
-            
-            soft_threshold_mcp(beta, u, lam, penalty_factor, denom, gamma);
-            
-        } else if (penalty == "grp.lasso")
-        {
-            block_soft_threshold(beta, u, lambda, group_weights,
-                                 d, grp_idx, ngroups, 
-                                 unique_groups, groups);
-        } else if (penalty == "grp.lasso.net")
-        {
-            double denom = d + (1.0 - alpha) * lambda;
-            double lam = lambda * alpha;
-            
-            block_soft_threshold(beta, u, lam, group_weights,
-                                 denom, grp_idx, ngroups, 
-                                 unique_groups, groups);
-            
-        } else if (penalty == "grp.mcp")
-        {
-            block_soft_threshold_mcp(beta, u, lambda, group_weights,
-                                     d, grp_idx, ngroups, 
-                                     unique_groups, groups, gamma);
-        } else if (penalty == "grp.scad")
-        {
-            block_soft_threshold_scad(beta, u, lambda, group_weights,
-                                      d, grp_idx, ngroups, 
-                                      unique_groups, groups, gamma);
-        } else if (penalty == "grp.mcp.net")
-        {
-            double denom = d + (1.0 - alpha) * lambda;
-            double lam = lambda * alpha;
-            
-            
-            block_soft_threshold_mcp(beta, u, lam, group_weights,
-                                     denom, grp_idx, ngroups, 
-                                     unique_groups, groups, gamma);
-        } else if (penalty == "grp.scad.net")
-        {
-            double denom = d + (1.0 - alpha) * lambda;
-            double lam = lambda * alpha;
-            
-            block_soft_threshold_scad(beta, u, lam, group_weights,
-                                      denom, grp_idx, ngroups, 
-                                      unique_groups, groups, gamma);
-        } else if (penalty == "sparse.grp.lasso")
-        {
-            double lam_grp = (1.0 - tau) * lambda;
-            double lam_l1  = tau * lambda;
-            
-            double fact = 1.0;
-            
-            // first apply soft thresholding
-            // but don't divide by d
-            soft_threshold(beta, u, lam_l1, penalty_factor, fact);
-            
-            VectorXd beta_tmp = beta;
-            
-            // then apply block soft thresholding
-            block_soft_threshold(beta, beta_tmp, lam_grp, 
-                                 group_weights,
-                                 d, grp_idx, ngroups, 
-                                 unique_groups, groups);
-        }
-        
-        
+        return b.dot(XY);
+    }
+    
+    bool next_u_delta(Vector &res, const Vector &delta)
+    {
+        add_sparse_A_prod(res, gram(), delta, gram_mult());
+        return true;
     }
     
+    bool sub_gram(MatrixXd &xx_sub, VectorXd &xy_sub, const std::vector<int> &idx)
+    {
+        sub_gram_from_XX(xx_sub, xy_sub, gram(), XY, idx, gram_mult());
+        return true;
+    }
     
     public:
+        // XX_ and XY_ are X'X / n and X'Y / n, or the sums X'X and 
+        // X'Y over nobs_ rows, which are then divided by nobs_ as 
+        // they are used rather than in a copy. yty_ is Y'Y on the
+        // same scale as XY_; the duality gap is only available 
+        // when it is given
         oemXTX(const Eigen::Ref<const MatrixXd>  &XX_, 
                ConstGenericVector &XY_,
                const VectorXi &groups_,
@@ -494,30 +153,39 @@ protected:
                VectorXd &group_weights_,
                VectorXd &penalty_factor_,
                const VectorXd &scale_factor_,
-               const double tol_ = 1e-6) :
+               const double tol_ = 1e-6,
+               const double nobs_ = 1.0,
+               const double yty_ = -1.0) :
         oemBase<Eigen::VectorXd>(XX_.rows(), 
                                  XX_.cols(),
-                                 unique_groups_.size(),
+                                 groups_,
+                                 unique_groups_,
+                                 group_weights_,
+                                 penalty_factor_,
                                  false, 
                                  false,
                                  tol_),
                                  XX(XX_.data(), XX_.rows(), XX_.cols()),
                                  XY_init(XY_.data(), XY_.size()),
                                  XY(XY_.size()),
-                                 groups(groups_),
-                                 unique_groups(unique_groups_),
-                                 penalty_factor(penalty_factor_),
-                                 group_weights(group_weights_),
                                  scale_factor(scale_factor_),
                                  scale_factor_inv(XX_.cols()),
                                  penalty_factor_size(penalty_factor_.size()),
-                                 default_group_weights(bool(group_weights_.size() < 1)), // compute default weights if none given
-                                                                                    grp_idx(unique_groups_.size())
+                                 xx_mult(1.0 / nobs_),
+                                 yty_init(yty_)
         
-                                                                                    {}
+        {}
         
         
         void init_oem()
+        {
+            init_oem(0.0);
+        }
+        
+        // d_ > 0 is the largest eigenvalue of the (scaled) X'X 
+        // when it is already known, e.g. when X'X is shared 
+        // with another solver, so it is not recomputed
+        void init_oem(double d_)
         {
             scale_len = scale_factor.size();
             
@@ -526,15 +194,18 @@ protected:
             if (scale_len)
             {
                 scale_factor_inv = 1 / scale_factor.array();
-                XY = XY_init.array() * scale_factor_inv.array();
+                XY = XY_init.array() * scale_factor_inv.array() * xx_mult;
             } else 
             {
-                XY = XY_init;
+                XY = XY_init * xx_mult;
             }
             
+            // Y is not affected by scale_factor
+            yty = (yty_init >= 0.0) ? yty_init * xx_mult : -1.0;
+            
             // compute XtX or XXt (depending on if n > p or not)
             // and compute A = dI - XtX (if n > p)
-            compute_XtX_d_update_A();
+            compute_XtX_d_update_A(d_);
         }
         
         double compute_lambda_zero() 
@@ -542,8 +213,7 @@ protected:
             lambda0 = XY.cwiseAbs().maxCoeff();
             return lambda0; 
         }
-        double get_d() { return d; }
-        
+            
         // init() is a cold start for the first lambda
         void init(double lambda_, std::string penalty_,
                   double alpha_, double gamma_, double tau_)
@@ -551,7 +221,7 @@ protected:
             beta.setZero();
             
             lambda = lambda_;
-            penalty = penalty_;
+            set_penalty(penalty_);
             
             alpha = alpha_;
             gamma = gamma_;
@@ -573,10 +243,13 @@ protected:
             
         }
         
+        // coefficients on the original scale. beta itself is 
+        // left alone, so repeated calls and warm starts along 
+        // the path see the same state
         VectorXd get_beta() 
         { 
             if (scale_len)
-                beta.array() *= scale_factor_inv.array();
+                return (beta.array() * scale_factor_inv.array()).matrix();
             return beta;
         }
         
@@ -0,0 +1,236 @@
+#ifndef OEM_XTX_STREAM_H
+#define OEM_XTX_STREAM_H
+
+#ifdef _OPENMP
+    #define has_openmp 1
+    #include <omp.h>
+#else
+    #define has_openmp 0
+    #define omp_get_num_threads() 1
+    #define omp_set_num_threads(x) 1
+    #define omp_get_max_threads() 1
+    #define omp_get_num_threads() 1
+    #define omp_get_num_procs() 1
+    #define omp_get_thread_limit() 1
+    #define omp_set_dynamic(x) 1
+    #define omp_get_thread_num() 0
+#endif
+
+#include "utils.h"
+#include "Linalg/Gram.h"
+#include <fstream>
+#include <string>
+#include <stdexcept>
+
+
+// accumulates the sufficient statistics of a least squares
+// problem, X'WX, X'WY, Y'WY, the weighted column sums and sums of
+// squares of X and the total weight, from chunks of rows so that
+// X never has to be held in memory at once. all are kept as plain
+// sums; oemXTX divides X'WX and X'WY by the number of rows as it
+// uses them, so the accumulated X'WX is never copied
+class XTXAccumulator
+{
+protected:
+    int nvars;                  // number of columns of X
+    int ncores;
+    MatrixXd xtx;               // X'WX, full symmetric
+    VectorXd xty;               // X'WY
+    double yty;                 // Y'WY
+    RowVectorXd colsums;        // column sums of WX
+    RowVectorXd colsq;          // column sums of squares of X, weighted by W
+    double wsum;                // total weight, equal to nobs without weights
+    double nobs;                // number of rows added so far
+    std::string failed;         // why the sums are unusable, empty if they are fine
+
+    // reads the next chunk_rows records of in into the columns 
+    // of buf, returning the number of whole records read
+    static int read_chunk(std::ifstream &in, MatrixXd &buf, int reclen, int chunk_rows)
+    {
+        in.read((char *) buf.data(), std::streamsize(sizeof(double)) * reclen * chunk_rows);
+        return int(in.gcount() / std::streamsize(sizeof(double) * reclen));
+    }
+
+    void check_usable() const
+    {
+        if (!failed.empty())
+        {
+            throw std::invalid_argument("the xtx.stream can't be used after " + failed + "; start a new one");
+        }
+    }
+
+public:
+    XTXAccumulator(int nvars_, int ncores_ = 1) :
+    nvars(nvars_),
+    ncores(std::max(ncores_, 1)),
+    xtx(MatrixXd::Zero(nvars_, nvars_)),
+    xty(VectorXd::Zero(nvars_)),
+    yty(0.0),
+    colsums(RowVectorXd::Zero(nvars_)),
+    colsq(RowVectorXd::Zero(nvars_)),
+    wsum(0.0),
+    nobs(0.0)
+    {}
+
+    // adds the rows of X and Y, with weights W if W is not empty
+    template <typename MatType, typename VecType>
+    void add_rows(const MatType &X, const VecType &Y, const VectorXd &W)
+    {
+        check_usable();
+
+        const int m = X.rows();
+        const bool wtd = (W.size() > 0);
+
+        if (X.cols() != nvars)
+        {
+            throw std::invalid_argument("number of columns of x does not match the accumulated X'X");
+        }
+        if (Y.size() != m || (wtd && W.size() != m))
+        {
+            throw std::invalid_argument("x, y and weights must have the same number of rows");
+        }
+        if (wtd && (W.array() < 0.0).any())
+        {
+            throw std::invalid_argument("weights must be nonnegative");
+        }
+        if (m == 0)
+        {
+            return;
+        }
+
+        Linalg::gram_tiled_update(xtx, X, (wtd ? W.data() : (const double*) NULL), ncores);
+
+        VectorXd wy = Y;
+        if (wtd)
+        {
+            wy.array() *= W.array();
+        }
+
+        #pragma omp parallel for schedule(static) num_threads(ncores)
+        for (int j = 0; j < nvars; ++j)
+        {
+            xty(j) += X.col(j).template cast<double>().dot(wy);
+            if (wtd)
+            {
+                colsums(j) += X.col(j).template cast<double>().dot(W);
+                colsq(j)   += (X.col(j).template cast<double>().array().square() * W.array()).sum();
+            } else
+            {
+                colsums(j) += X.col(j).template cast<double>().sum();
+                colsq(j)   += X.col(j).template cast<double>().squaredNorm();
+            }
+        }
+
+        yty  += wy.dot(Y);
+        wsum += wtd ? W.sum() : double(m);
+        nobs += m;
+    }
+
+    // adds the rows stored in a binary file of doubles. each row is
+    // a record of the response, then its weight if weighted is true,
+    // then the nvars covariates, in native byte order. the file is
+    // read chunk_rows records at a time. either all of the file is
+    // added or, if it is not a whole number of records or holds a 
+    // negative weight, none of it is: the size is checked first and
+    // the weights are checked in a first pass over the file, so the
+    // pass that adds rows can only fail if the file can't be read 
+    // any more. the sums are then unusable, which later calls report.
+    // returns the number of rows
+    double add_file(const std::string &path, bool weighted, int chunk_rows)
+    {
+        check_usable();
+
+        std::ifstream in(path.c_str(), std::ios::in | std::ios::binary);
+        if (!in)
+        {
+            throw std::invalid_argument("cannot open " + path);
+        }
+
+        const int reclen = nvars + 1 + int(weighted);
+        const int first  = 1 + int(weighted);
+        const std::streamoff recbytes = std::streamoff(sizeof(double)) * reclen;
+        chunk_rows = std::max(chunk_rows, 1);
+
+        in.seekg(0, std::ios::end);
+        const std::streamoff bytes = in.tellg();
+        in.seekg(0, std::ios::beg);
+        if (bytes < 0 || bytes % recbytes != 0)
+        {
+            throw std::invalid_argument(path + " does not hold a whole number of rows");
+        }
+        const double nrec = double(bytes / recbytes);
+
+        // column j of buf is row j of the chunk
+        MatrixXd buf(reclen, chunk_rows);
+        VectorXd W;
+
+        if (weighted)
+        {
+            double nchecked = 0.0;
+            for (int m; (m = read_chunk(in, buf, reclen, chunk_rows)) > 0; )
+            {
+                if ((buf.row(1).head(m).array() < 0.0).any())
+                {
+                    throw std::invalid_argument(path + " holds negative weights");
+                }
+                nchecked += m;
+            }
+            if (in.bad() || nchecked != nrec)
+            {
+                throw std::invalid_argument("error reading " + path);
+            }
+            in.clear();
+            in.seekg(0, std::ios::beg);
+        }
+
+        double nread = 0.0;
+        try
+        {
+            for (int m; (m = read_chunk(in, buf, reclen, chunk_rows)) > 0; )
+            {
+                if (weighted)
+                {
+                    W = buf.row(1).head(m).transpose();
+                }
+                add_rows(buf.block(first, 0, nvars, m).transpose(),
+                         buf.row(0).head(m).transpose(), W);
+                nread += m;
+            }
+
+            if (in.bad() || nread != nrec)
+            {
+                throw std::invalid_argument("error reading " + path);
+            }
+        } catch (...)
+        {
+            // the rows added so far can't be taken back out
+            failed = "a failed read of " + path;
+            throw;
+        }
+        return nread;
+    }
+
+    // the sums X'WX and X'WY, for oemXTX with nobs rows
+    const MatrixXd &get_xtx() const { check_usable(); return xtx; }
+    const VectorXd &get_xty() const { check_usable(); return xty; }
+    double get_yty() const { check_usable(); return yty; }
+
+    int get_nvars() const { return nvars; }
+    double get_nobs() const { return nobs; }
+
+    Rcpp::List get_stats() const
+    {
+        check_usable();
+        return Rcpp::List::create(Rcpp::Named("xtx")     = xtx,
+                                  Rcpp::Named("xty")     = xty,
+                                  Rcpp::Named("yty")     = yty,
+                                  Rcpp::Named("colsums") = colsums,
+                                  Rcpp::Named("colsq")   = colsq,
+                                  Rcpp::Named("wsum")    = wsum,
+                                  Rcpp::Named("nobs")    = nobs);
+    }
+};
+
+
+
+#endif // OEM_XTX_STREAM_H
@@ -70,9 +70,9 @@ RcppExport SEXP oem_xval_dense(SEXP x_,
     
     VectorXd Y(n);
     
-    // Copy data 
-    const MapMatd XX(as<MapMatd >(xx));
-    const MatrixRXd X(XX);
+    // X is used in place. the fold pieces of X'X
+    // are computed from its columns directly
+    const MapMatd X(as<MapMatd >(xx));
     
     // std::copy(xx.begin(), xx.end(), XX.data());
     std::copy(yy.begin(), yy.end(), Y.data());
@@ -106,6 +106,7 @@ RcppExport SEXP oem_xval_dense(SEXP x_,
     const int maxit        = as<int>(opts["maxit"]);
     int ncores             = as<int>(opts["ncores"]);
     const double tol       = as<double>(opts["tol"]);
+    const int aa_depth     = as<int>(opts["anderson_depth"]);
     const double alpha     = as<double>(alpha_);
     const double gamma     = as<double>(gamma_);
     const double tau       = as<double>(tau_);
@@ -119,11 +120,8 @@ RcppExport SEXP oem_xval_dense(SEXP x_,
     VectorXd penalty_factor(as<VectorXd>(penalty_factor_));
     
     
-    // take all threads but one
-    if (ncores < 1)
-    {
-        ncores = std::max(omp_get_num_threads() - 1, 1);
-    }
+    // ncores < 1 takes all threads but one
+    ncores = resolve_ncores(ncores);
     
     omp_set_num_threads(ncores);
     
@@ -146,7 +144,7 @@ RcppExport SEXP oem_xval_dense(SEXP x_,
     }
     
     // initialize pointers 
-    oemBase<Eigen::VectorXd> *solver = NULL; // solver doesn't point to anything yet
+    oemXvalDense *solver = NULL; // solver doesn't point to anything yet
     
     
     // initialize classes
@@ -163,6 +161,9 @@ RcppExport SEXP oem_xval_dense(SEXP x_,
     }
     
     
+    // safeguarded Anderson acceleration of the oem iterations
+    solver->set_anderson(aa_depth);
+    
     // only compute X'X parts once
     solver->init_xtx(intercept);
     
@@ -211,134 +212,173 @@ RcppExport SEXP oem_xval_dense(SEXP x_,
     
     std::string elasticnettxt(".net");
     
-    for (int ff = 0; ff < nfolds + 1; ++ff)
+    // fit the models on the entire dataset
+    for (unsigned int pp = 0; pp < penalty.size(); pp++)
     {
-        // ff == 0 will fit the models
-        // on the entire dataset
-        // ff = 1, ..., nfolds will fit the models
-        // for each cross validation fold
+        if (penalty[pp] == "ols")
+        {
+            nlambda = 1L;
+        }
         
-        if (ff > 0)
+        bool is_net_pen = penalty[pp].find(elasticnettxt) != std::string::npos;
+        
+        if (provided_lambda)
         {
-            // update X'X and X'Y on this fold's 
-            // subset of data
-            solver->update_xtx(ff);
-            
+            lambda_tmp = lambda[pp];
+        } else 
+        {
+            if (is_net_pen)
+            {
+                lambda_tmp = (lambda_base.array() / alpha).matrix(); // * n; // 
+            } else
+            {
+                lambda_tmp = lambda_base; // * n; // 
+            }
         }
         
-        for (unsigned int pp = 0; pp < penalty.size(); pp++)
+        nlam_list[pp] = nlambda;
+        
+        VectorXd loss(nlambda);
+        loss.fill(1e99);
+        
+        for(int i = 0; i < nlambda; i++)
         {
-            if (penalty[pp] == "ols")
+            
+            if (i % 10 == 0)
             {
-                nlambda = 1L;
+                Rcpp::checkUserInterrupt();
             }
             
-            bool is_net_pen = penalty[pp].find(elasticnettxt) != std::string::npos;
             
-            if (provided_lambda)
+            ilambda = lambda_tmp(i);
+            
+            if(i == 0)
+                solver->init(ilambda, penalty[pp],
+                             alpha, gamma, tau);
+            else
+                solver->init_warm(ilambda);
+            
+            niter[i] = solver->solve(maxit);
+            VectorXd res = solver->get_beta();
+            
+            if (intercept)
             {
-                lambda_tmp = lambda[pp];
+                beta.block(0, i, p + 1, 1) = res;
             } else 
             {
-                if (is_net_pen)
-                {
-                    lambda_tmp = (lambda_base.array() / alpha).matrix(); // * n; // 
-                } else
-                {
-                    lambda_tmp = lambda_base; // * n; // 
-                }
+                beta.block(1, i, p, 1) = res;
             }
             
-            if (ff == 0)
+            // only compute loss if asked for 
+            if (compute_loss)
             {
-                //out_of_fold_predictions_list[pp] = MatrixXd(n, nlambda);
-                nlam_list[pp] = nlambda;
+                // get associated loss
+                loss(i) = solver->get_loss();
             }
             
-            VectorXd loss(nlambda);
-            loss.fill(1e99);
             
-            for(int i = 0; i < nlambda; i++)
-            {
-                
-                if (i % 10 == 0)
-                {
-                    Rcpp::checkUserInterrupt();
-                }
-                
-                
-                ilambda = lambda_tmp(i);
-                
-                if(i == 0)
-                    solver->init(ilambda, penalty[pp],
-                                 alpha, gamma, tau);
-                else
-                    solver->init_warm(ilambda);
-                
-                niter[i] = solver->solve(maxit);
-                VectorXd res = solver->get_beta();
-                
-                
-                //double beta0 = 0.0;
-                //beta(0,i) = beta0;
-                //beta.block(1, i, p, 1) = res;
-                if (intercept)
-                {
-                    beta.block(0, i, p + 1, 1) = res;
-                } else 
-                {
-                    beta.block(1, i, p, 1) = res;
-                }
-                
-                // only compute loss if asked for 
-                // and not for any cross validation folds
-                if (compute_loss && ff == 0)
-                {
-                    // get associated loss
-                    loss(i) = solver->get_loss();
-                }
-                
-                
-            } //end loop over lambda values
+        } //end loop over lambda values
+        
+        lambda[pp] = lambda_tmp;
+        
+        if (penalty[pp] == "ols")
+        {
+            // reset to old nlambda
+            nlambda = nlambda_store;
+            beta_list(pp) = beta.col(0);
+            iter_list(pp) = niter(0);
+            loss_list(pp) = loss(0);
+        } else 
+        {
+            beta_list(pp) = beta;
+            iter_list(pp) = niter;
+            loss_list(pp) = loss;
+        }
+        
+    } // end loop over penalties
+    
+    
+    // fit the models for each cross validation fold.
+    // each fold is fit by its own solver on its own thread.
+    // the fold solvers share the fold pieces of X'X held
+    // by the full data solver, and fold ff only writes
+    // beta_folds[pp][ff-1], so the results do not depend
+    // on the order in which the folds finish. R is not 
+    // called inside this loop, so errors are collected
+    // and thrown after it
+    std::string fold_error;
+    
+    #pragma omp parallel for schedule(dynamic, 1) num_threads(ncores)
+    for (int ff = 1; ff < nfolds + 1; ++ff)
+    {
+        oemXvalDense *fold_solver = NULL;
+        
+        try
+        {
+            fold_solver = new oemXvalDense(X, Y, weights, nfolds, foldid,
+                                           groups, unique_groups, 
+                                           group_weights, penalty_factor, 
+                                           intercept, standardize, tol);
+            
+            fold_solver->set_anderson(aa_depth);
+            
+            // X'X and X'Y on this fold's 
+            // subset of data
+            fold_solver->share_xtx(*solver, ff);
             
-            if (ff == 0)
+            MatrixXd beta_fold(p + 1, nlambda_store);
+            beta_fold.setZero();
+            VectorXd lambda_fold;
+            
+            for (unsigned int pp = 0; pp < penalty.size(); pp++)
             {
-                lambda[pp] = lambda_tmp;
+                // the lambda path of the full data fit
+                lambda_fold = lambda[pp];
+                int nlambda_fold = nlam_list[pp];
                 
-                if (penalty[pp] == "ols")
+                for(int i = 0; i < nlambda_fold; i++)
                 {
-                    // reset to old nlambda
-                    nlambda = nlambda_store;
-                    beta_list(pp) = beta.col(0);
-                    iter_list(pp) = niter(0);
-                    loss_list(pp) = loss(0);
-                } else 
-                {
-                    beta_list(pp) = beta;
-                    iter_list(pp) = niter;
-                    loss_list(pp) = loss;
-                }
-            } else 
-            {
+                    if(i == 0)
+                        fold_solver->init(lambda_fold(i), penalty[pp],
+                                          alpha, gamma, tau);
+                    else
+                        fold_solver->init_warm(lambda_fold(i));
+                    
+                    fold_solver->solve(maxit);
+                    VectorXd res = fold_solver->get_beta();
+                    
+                    if (intercept)
+                    {
+                        beta_fold.block(0, i, p + 1, 1) = res;
+                    } else 
+                    {
+                        beta_fold.block(1, i, p, 1) = res;
+                    }
+                } //end loop over lambda values
+                
                 if (penalty[pp] == "ols")
                 {
-                    // reset to old nlambda
-                    nlambda = nlambda_store;
-                    //beta_folds[ff-1][pp] = beta.col(0);
-                    beta_folds[pp][ff-1] = beta.col(0);
-                    //iter_list(pp) = niter(0);
+                    beta_folds[pp][ff-1] = beta_fold.col(0);
                 } else 
                 {
-                    beta_folds[pp][ff-1] = beta;
-                    //beta_folds[ff-1][pp] = beta;
-                    //iter_list(pp) = niter;
+                    beta_folds[pp][ff-1] = beta_fold;
                 }
-            }
-            
-            
-        } // end loop over penalties
+            } // end loop over penalties
+        } catch (std::exception &e)
+        {
+            #pragma omp critical
+            fold_error = e.what();
+        }
+        
+        delete fold_solver;
     } // end loop over cross validation folds
     
+    if (!fold_error.empty())
+    {
+        throw std::invalid_argument(fold_error);
+    }
+    
+    
     bool use_weights = bool(weights.size() > 0);
     
     // compute cross validation scores for each model
@@ -366,7 +406,8 @@ RcppExport SEXP oem_xval_dense(SEXP x_,
         VectorXd tempres(nlam);
         VectorXd tempsdres(nlam);
         
-        // static enforces l = i comes before l = i + 1
+        // the running mean and sum of squares are updated 
+        // one row at a time in order, so these loops are serial
         VectorXd tmpcv(nlam);
         VectorXd tmpss(nlam);
         tmpcv.setZero();
@@ -374,8 +415,6 @@ RcppExport SEXP oem_xval_dense(SEXP x_,
         
         if (intercept)
         {
-            
-            #pragma omp parallel for schedule(static)
             for (int i = 0; i < n; ++i)
             {
                 VectorXd cur_preds = ((X.row(i) * beta_folds[pp][foldid(i)-1].bottomRows(p))).array()
@@ -413,7 +452,6 @@ RcppExport SEXP oem_xval_dense(SEXP x_,
             }
         } else 
         {
-            #pragma omp parallel for schedule(static)
             for (int i = 0; i < n; ++i)
             {
                 VectorXd cur_preds = X.row(i) * beta_folds[pp][foldid(i)-1].bottomRows(p);
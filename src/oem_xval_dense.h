@@ -19,6 +19,7 @@
 #include "oem_base.h"
 #include "Spectra/SymEigsSolver.h"
 #include "utils.h"
+#include "Linalg/Gram.h"
 
 
 
@@ -45,292 +46,35 @@ protected:
     typedef Eigen::SparseMatrix<double> SpMat;
     typedef Eigen::SparseVector<double> SparseVector;
     
-    const MapMatRd X;            // data matrix
+    const MapMatd X;             // data matrix
     MapVec Y;                   // response vector
     VectorXd weights;
     VectorXi foldid;            // id vector for cv folds
-    VectorXi groups;            // vector of group membersihp indexes 
-    VectorXi unique_groups;     // vector of all unique groups
-    VectorXd penalty_factor;    // penalty multiplication factors 
-    VectorXd group_weights;     // group lasso penalty multiplication factors 
     int penalty_factor_size;    // size of penalty_factor vector
     int XXdim;                  // dimension of XX (different if n > p and p >= n)
     Vector XY;                  // X'Y
     MatrixXd XX;                // X'X
-    MatrixXd A;                 // A = d * I - X'X
-    double d;                   // d value (largest eigenvalue of X'X)
-    bool default_group_weights; // do we need to compute default group weights?
     int nfolds;                 // number of cross validation folds
     std::vector<MatrixXd > xtx_list;
     std::vector<VectorXd > xty_list;
     std::vector<int > nobs_list;
     std::vector<VectorXd > colsq_list;
+    MatrixXd xtx_total;         // X'X over all folds
+    VectorXd xty_total;         // X'Y over all folds
+    int nobs_total;             // number of observations over all folds
+    VectorXd colsq_total;       // column sums of squares over all folds
+    VectorXd colsq_inv_total;   // column scaling of X'X over all folds
+    double eig_total;           // bound on the largest eigenvalue of X'X over all folds
+    const oemXvalDense *pieces; // solver holding the fold pieces above, this unless shared
     VectorXd colsq_inv;
     VectorXd colsq;
     
     
-    std::vector<std::vector<int> > grp_idx; // vector of vectors of the indexes for all members of each group
-    std::string penalty;        // penalty specified
     
-    double lambda;              // L1 penalty
     double lambda0;             // minimum lambda to make coefficients all zero
-    double alpha;               // alpha = mixing parameter for elastic net
-    double gamma;               // extra tuning parameter for mcp/scad
-    double tau;                 // mixing parameter for group sparse penalties
     
     double threshval;
     int wt_len;
-    bool found_grp_idx;
-    
-    static void soft_threshold(VectorXd &res, const VectorXd &vec, const double &penalty, 
-                               VectorXd &pen_fact, double &d)
-    {
-        int v_size = vec.size();
-        res.setZero();
-        
-        const double *ptr = vec.data();
-        for(int i = 0; i < v_size; i++)
-        {
-            double total_pen = pen_fact(i) * penalty;
-            
-            if(ptr[i] > total_pen)
-                res(i) = (ptr[i] - total_pen)/d;
-            else if(ptr[i] < -total_pen)
-                res(i) = (ptr[i] + total_pen)/d;
-        }
-    }
-    
-    static void soft_threshold_mcp(VectorXd &res, const VectorXd &vec, const double &penalty, 
-                                   VectorXd &pen_fact, double &d, double &gamma)
-    {
-        int v_size = vec.size();
-        res.setZero();
-        double gammad = gamma * d;
-        double d_minus_gammainv = d - 1.0 / gamma;
-        
-        
-        const double *ptr = vec.data();
-        for(int i = 0; i < v_size; i++)
-        {
-            double total_pen = pen_fact(i) * penalty;
-            
-            if (std::abs(ptr[i]) > gammad * total_pen)
-                res(i) = ptr[i]/d;
-            else if(ptr[i] > total_pen)
-                res(i) = (ptr[i] - total_pen)/(d_minus_gammainv);
-            else if(ptr[i] < -total_pen)
-                res(i) = (ptr[i] + total_pen)/(d_minus_gammainv);
-            
-        }
-        
-    }
-    
-    static void soft_threshold_scad(VectorXd &res, const VectorXd &vec, const double &penalty, 
-                                    VectorXd &pen_fact, double &d, double &gamma)
-    {
-        int v_size = vec.size();
-        res.setZero();
-        double gammad = gamma * d;
-        double gamma_minus1_d = (gamma - 1.0) * d;
-        
-        const double *ptr = vec.data();
-        for(int i = 0; i < v_size; i++)
-        {
-            double total_pen = pen_fact(i) * penalty;
-            
-            if (std::abs(ptr[i]) > gammad * total_pen)
-                res(i) = ptr[i]/d;
-            else if (std::abs(ptr[i]) > (d + 1.0) * total_pen)
-            {
-                double gam_ptr = (gamma - 1.0) * ptr[i];
-                double gam_pen = gamma * total_pen;
-                if(gam_ptr > gam_pen)
-                    res(i) = (gam_ptr - gam_pen)/(gamma_minus1_d - 1.0);
-                else if(gam_ptr < -gam_pen)
-                    res(i) = (gam_ptr + gam_pen)/(gamma_minus1_d - 1.0);
-            }
-            else if(ptr[i] > total_pen)
-                res(i) = (ptr[i] - total_pen)/d;
-            else if(ptr[i] < -total_pen)
-                res(i) = (ptr[i] + total_pen)/d;
-            
-        }
-    }
-    
-    static double soft_threshold_scad_norm(double &b, const double &pen, double &d, double &gamma)
-    {
-        double retval = 0.0;
-        
-        double gammad = gamma * d;
-        double gamma_minus1_d = (gamma - 1.0) * d;
-        
-        if (std::abs(b) > gammad * pen)
-            retval = 1.0;
-        else if (std::abs(b) > (d + 1.0) * pen)
-        {
-            double gam_ptr = (gamma - 1.0);
-            double gam_pen = gamma * pen / b;
-            if(gam_ptr > gam_pen)
-                retval = d * (gam_ptr - gam_pen)/(gamma_minus1_d - 1.0);
-            else if(gam_ptr < -gam_pen)
-                retval = d * (gam_ptr + gam_pen)/(gamma_minus1_d - 1.0);
-        }
-        else if(b > pen)
-            retval = (1.0 - pen / b);
-        else if(b < -pen)
-            retval = (1.0 + pen / b);
-        return retval;
-    }
-    
-    static double soft_threshold_mcp_norm(double &b, const double &pen, double &d, double &gamma)
-    {
-        double retval = 0.0;
-        
-        double gammad = gamma * d;
-        double d_minus_gammainv = d - 1.0 / gamma;
-        
-        if (std::abs(b) > gammad * pen)
-            retval = 1.0;
-        else if(b > pen)
-            retval = d * (1.0 - pen / b)/(d_minus_gammainv);
-        else if(b < -pen)
-            retval = d * (1.0 + pen / b)/(d_minus_gammainv);
-        
-        return retval;
-    }
-    
-    static void block_soft_threshold_scad(VectorXd &res, const VectorXd &vec, const double &penalty,
-                                          VectorXd &pen_fact, double &d,
-                                          std::vector<std::vector<int> > &grp_idx, 
-                                          const int &ngroups, VectorXi &unique_grps, VectorXi &grps,
-                                          double & gamma)
-    {
-        //int v_size = vec.size();
-        res.setZero();
-        
-        for (int g = 0; g < ngroups; ++g) 
-        {
-            double thresh_factor;
-            std::vector<int> gr_idx = grp_idx[g];
-            
-            if (unique_grps(g) == 0) // the 0 group represents unpenalized variables
-            {
-                thresh_factor = 1.0;
-            } else 
-            {
-                double ds_norm = 0.0;
-                for (std::vector<int>::size_type v = 0; v < gr_idx.size(); ++v)
-                {
-                    int c_idx = gr_idx[v];
-                    ds_norm += std::pow(vec(c_idx), 2);
-                }
-                ds_norm = std::sqrt(ds_norm);
-                // double grp_wts = sqrt(gr_idx.size());
-                double grp_wts = pen_fact(g);
-                //thresh_factor = std::max(0.0, 1.0 - penalty * grp_wts / (ds_norm) );
-                thresh_factor = soft_threshold_scad_norm(ds_norm, penalty * grp_wts, d, gamma);
-            }
-            if (thresh_factor != 0.0)
-            {
-                for (std::vector<int>::size_type v = 0; v < gr_idx.size(); ++v)
-                {
-                    int c_idx = gr_idx[v];
-                    res(c_idx) = vec(c_idx) * thresh_factor / d;
-                }
-            }
-        }
-    }
-    
-    static void block_soft_threshold_mcp(VectorXd &res, const VectorXd &vec, const double &penalty,
-                                         VectorXd &pen_fact, double &d,
-                                         std::vector<std::vector<int> > &grp_idx, 
-                                         const int &ngroups, VectorXi &unique_grps, VectorXi &grps,
-                                         double & gamma)
-    {
-        //int v_size = vec.size();
-        res.setZero();
-        
-        for (int g = 0; g < ngroups; ++g) 
-        {
-            double thresh_factor;
-            std::vector<int> gr_idx = grp_idx[g];
-            
-            if (unique_grps(g) == 0) // the 0 group represents unpenalized variables
-            {
-                thresh_factor = 1.0;
-            } else 
-            {
-                double ds_norm = 0.0;
-                for (std::vector<int>::size_type v = 0; v < gr_idx.size(); ++v)
-                {
-                    int c_idx = gr_idx[v];
-                    ds_norm += std::pow(vec(c_idx), 2);
-                }
-                ds_norm = std::sqrt(ds_norm);
-                // double grp_wts = sqrt(gr_idx.size());
-                double grp_wts = pen_fact(g);
-                //thresh_factor = std::max(0.0, 1.0 - penalty * grp_wts / (ds_norm) );
-                thresh_factor = soft_threshold_mcp_norm(ds_norm, penalty * grp_wts, d, gamma);
-            }
-            if (thresh_factor != 0.0)
-            {
-                for (std::vector<int>::size_type v = 0; v < gr_idx.size(); ++v)
-                {
-                    int c_idx = gr_idx[v];
-                    res(c_idx) = vec(c_idx) * thresh_factor / d;
-                }
-            }
-        }
-    }
-    
-    static void block_soft_threshold(VectorXd &res, const VectorXd &vec, const double &penalty,
-                                     VectorXd &pen_fact, double &d,
-                                     std::vector<std::vector<int> > &grp_idx, 
-                                     const int &ngroups, VectorXi &unique_grps, VectorXi &grps)
-    {
-        //int v_size = vec.size();
-        res.setZero();
-        
-        for (int g = 0; g < ngroups; ++g) 
-        {
-            double thresh_factor;
-            std::vector<int> gr_idx = grp_idx[g];
-            /*
-            for (int v = 0; v < v_size; ++v) 
-            {
-                if (grps(v) == unique_grps(g)) 
-                {
-                    gr_idx.push_back(v);
-                }
-            }
-             */
-            if (unique_grps(g) == 0) 
-            {
-                thresh_factor = 1.0;
-            } else 
-            {
-                double ds_norm = 0.0;
-                for (std::vector<int>::size_type v = 0; v < gr_idx.size(); ++v)
-                {
-                    int c_idx = gr_idx[v];
-                    ds_norm += std::pow(vec(c_idx), 2);
-                }
-                ds_norm = std::sqrt(ds_norm);
-                // double grp_wts = sqrt(gr_idx.size());
-                double grp_wts = pen_fact(g);
-                thresh_factor = std::max(0.0, 1.0 - penalty * grp_wts / (ds_norm) );
-            }
-            if (thresh_factor != 0.0)
-            {
-                for (std::vector<int>::size_type v = 0; v < gr_idx.size(); ++v)
-                {
-                    int c_idx = gr_idx[v];
-                    res(c_idx) = vec(c_idx) * thresh_factor / d;
-                }
-            }
-        }
-    }
-    
     
     MatrixXd XtX() const {
         return MatrixXd(XXdim, XXdim).setZero().selfadjointView<Lower>().
@@ -343,286 +87,103 @@ protected:
     }
     
     MatrixXd XtWX() const {
-        return MatrixXd(nvars, nvars).setZero().selfadjointView<Lower>().
-        rankUpdate(X.adjoint() * (weights.array().sqrt().matrix()).asDiagonal() );
+        // weights are applied inside the tiled product
+        MatrixXd XXtmp;
+        Linalg::gram_tiled(XXtmp, X, weights.data(), 1);
+        return XXtmp;
     }
     
     MatrixXd XWXt() const {
-        return MatrixXd(nobs, nobs).setZero().selfadjointView<Lower>().
-        rankUpdate( (weights.array().sqrt().matrix()).asDiagonal() * X );
+        MatrixXd XXtmp;
+        Linalg::outer_gram_weighted(XXtmp, X, weights);
+        return XXtmp;
     }
     
     
     // computing all the X'X and X'Y pieces
-    // for all k folds
+    // for all k folds in a single pass over X.
+    // the fold of each row decides which fold's
+    // accumulators it is added to, so neither the
+    // rows of a fold nor a row-major X are copied.
+    // with add_int_ the pieces also hold the 
+    // intercept's row and column in front.
+    // with weights, X'WX and X'WY are computed 
+    // and the intercept column holds the weighted
+    // column sums, but colsq is not weighted
     void XtX_xval(std::vector<MatrixXd > &xtx_list_, 
                   std::vector<VectorXd > &xty_list_,
                   std::vector<int > &nobs_list_, 
-                  std::vector<VectorXd > &colsq_list_) const {
+                  std::vector<VectorXd > &colsq_list_,
+                  bool add_int_) const {
         
-        // MatrixRXd A = X;
+        const bool wtd = (wt_len > 0);
+        const int ncores = omp_get_max_threads();
         
+        // zero based fold of each row
+        VectorXi fold = foldid.array() - 1;
         
-        // static enforces k = i comes before k = i + 1
-        #pragma omp parallel for schedule(static)
-        for (int k = 1; k < nfolds + 1; ++k)
+        std::vector<MatrixXd > gram_list(nfolds, MatrixXd::Zero(nvars, nvars));
+        Linalg::gram_folds_update(gram_list, X, fold.data(), 
+                                  (wtd ? weights.data() : (const double*) NULL), ncores);
+        
+        VectorXd wy = Y;
+        if (wtd)
         {
-            
-            VectorXi idxbool = (foldid.array() == k).cast<int>();
-            int nrow_cur = idxbool.size();
-            int numelem = idxbool.sum();
-            VectorXi idx(numelem);
-            int c = 0;
-            for (int i = 0; i < nrow_cur; ++i)
-            {
-                if (idxbool(i) == 1)
-                {
-                    idx(c) = i;
-                    ++c;
-                }
-            }
-            
-            // store subset of matrix X and response Y for this fold
-            MatrixXd sub(numelem, nvars);
-            VectorXd sub_y(numelem);
-            for (int r = 0; r < numelem; ++r)
-            {
-                sub.row(r) = X.row(idx(r));
-                sub_y(r) = Y(idx(r));
-            }
-            
-            MatrixXd AtAtmp(MatrixXd(nvars, nvars).setZero().
-                            selfadjointView<Lower>().rankUpdate(sub.adjoint() ));
-            
-            VectorXd AtBtmp = sub.adjoint() * sub_y;
-            
-            VectorXd colsqtmp = sub.array().square().colwise().sum();
-            
-            sub.resize(0,0);
-            
-            // store the X'X and X'Y of the subset
-            // of data for fold k
-            xtx_list_[k-1] = AtAtmp;
-            xty_list_[k-1] = AtBtmp;
-            nobs_list_[k-1] = numelem;
-            colsq_list_[k-1] = colsqtmp;
-            
+            wy.array() *= weights.array();
         }
-    }
-    
-    
-    // computing all the X'X and X'Y pieces
-    // for all k folds
-    // when an intercept is needed
-    void XtX_xval_int(std::vector<MatrixXd > &xtx_list_, 
-                      std::vector<VectorXd > &xty_list_,
-                      std::vector<int > &nobs_list_, 
-                      std::vector<VectorXd > &colsq_list_) const {
-        
-        //MatrixRXd A = X;
         
+        // column j of each of these holds 
+        // the sums of fold j
+        MatrixXd xty_k(nvars, nfolds), colsums_k(nvars, nfolds), colsq_k(nvars, nfolds);
+        xty_k.setZero();
+        colsums_k.setZero();
+        colsq_k.setZero();
         
-        // static enforces k = i comes before k = i + 1
-        #pragma omp parallel for schedule(static)
-        for (int k = 1; k < nfolds + 1; ++k)
+        #pragma omp parallel for schedule(static) num_threads(ncores)
+        for (int j = 0; j < nvars; ++j)
         {
-            
-            VectorXi idxbool = (foldid.array() == k).cast<int>();
-            int nrow_cur = idxbool.size();
-            int numelem = idxbool.sum();
-            VectorXi idx(numelem);
-            int c = 0;
-            for (int i = 0; i < nrow_cur; ++i)
-            {
-                if (idxbool(i) == 1)
-                {
-                    idx(c) = i;
-                    ++c;
-                }
-            }
-            
-            // store subset of matrix X and response Y for this fold
-            MatrixXd sub(numelem, nvars);
-            VectorXd sub_y(numelem);
-            for (int r = 0; r < numelem; ++r)
+            for (int i = 0; i < nobs; ++i)
             {
-                sub.row(r) = X.row(idx(r));
-                sub_y(r) = Y(idx(r));
+                const int k = fold(i);
+                const double xij = X(i, j);
+                xty_k(j, k)     += xij * wy(i);
+                colsums_k(j, k) += wtd ? xij * weights(i) : xij;
+                colsq_k(j, k)   += xij * xij;
             }
-            
-            MatrixXd AtAtmp(MatrixXd(nvars+1, nvars+1).setZero());
-            
-            // compute X'X for this fold 
-            // with intercept 
-            AtAtmp.bottomRightCorner(nvars, nvars) = MatrixXd(nvars, nvars).setZero()
-                .selfadjointView<Lower>().rankUpdate(sub.adjoint() );
-            
-            Eigen::RowVectorXd colsums = sub.colwise().sum();
-            AtAtmp.block(0,1,1,nvars) = colsums;
-            AtAtmp.block(1,0,nvars,1) = colsums.transpose();
-            AtAtmp(0,0) = numelem;
-            
-            
-            // compute X'Y for this fold 
-            // with intercept 
-            VectorXd AtBtmp(nvars + 1);
-            AtBtmp.tail(nvars) = sub.adjoint() * sub_y;
-            AtBtmp(0) = sub_y.sum();
-            
-            VectorXd colsqtmp = sub.array().square().colwise().sum();
-            
-            sub.resize(0,0);
-            
-            // store the X'X and X'Y of the subset
-            // of data for fold k
-            xtx_list_[k-1] = AtAtmp;
-            xty_list_[k-1] = AtBtmp;
-            nobs_list_[k-1] = numelem;
-            colsq_list_[k-1] = colsqtmp;
-            
         }
-    }
-    
-    // computing all the X'X and X'Y pieces
-    // for all k folds 
-    // when observation weights are used
-    void XtWX_xval(std::vector<MatrixXd > &xtx_list_, 
-                   std::vector<VectorXd > &xty_list_,
-                   std::vector<int > &nobs_list_, 
-                   std::vector<VectorXd > &colsq_list_) const {
-        
-        //MatrixRXd A = X;
         
-        
-        // static enforces k = i comes before k = i + 1
-        #pragma omp parallel for schedule(static)
-        for (int k = 1; k < nfolds + 1; ++k)
+        VectorXd ysum_k(VectorXd::Zero(nfolds)), wsum_k(VectorXd::Zero(nfolds));
+        VectorXi nobs_k(VectorXi::Zero(nfolds));
+        for (int i = 0; i < nobs; ++i)
         {
-            
-            VectorXi idxbool = (foldid.array() == k).cast<int>();
-            int nrow_cur = idxbool.size();
-            int numelem = idxbool.sum();
-            VectorXi idx(numelem);
-            int c = 0;
-            for (int i = 0; i < nrow_cur; ++i)
-            {
-                if (idxbool(i) == 1)
-                {
-                    idx(c) = i;
-                    ++c;
-                }
-            }
-            
-            // store subset of matrix X and response Y for this fold
-            MatrixXd sub(numelem, nvars);
-            VectorXd sub_y(numelem);
-            VectorXd sub_weights(numelem);
-            for (int r = 0; r < numelem; ++r)
-            {
-                int idx_tmp_val = idx(r);
-                sub.row(r)      = X.row(idx_tmp_val);
-                sub_y(r)        = Y(idx_tmp_val);
-                sub_weights(r)  = weights(idx_tmp_val);
-            }
-            
-            MatrixXd AtWAtmp(MatrixXd(nvars, nvars).setZero().
-                                selfadjointView<Lower>().rankUpdate( ((sub_weights.array().sqrt().matrix()).asDiagonal() * sub).adjoint() ));
-            
-            VectorXd AtWBtmp = sub.adjoint() * (sub_y.array() * sub_weights.array()).matrix();
-            
-            // this commented code is wrong! we do not standardize with respect to weights
-            //VectorXd colsqtmp = ((sub_weights.array().sqrt().matrix()).asDiagonal() * sub).array().square().colwise().sum();
-            VectorXd colsqtmp = sub.array().square().colwise().sum();
-            
-            sub.resize(0,0);
-            
-            // store the X'X and X'Y of the subset
-            // of data for fold k
-            xtx_list_[k-1]   = AtWAtmp;
-            xty_list_[k-1]   = AtWBtmp;
-            nobs_list_[k-1]  = numelem;
-            colsq_list_[k-1] = colsqtmp;
-            
+            const int k = fold(i);
+            ysum_k(k) += wy(i);
+            wsum_k(k) += wtd ? weights(i) : 1.0;
+            ++nobs_k(k);
         }
-    }
-    
-    
-    // computing all the X'X and X'Y pieces
-    // for all k folds
-    // when an intercept is needed and weights are used
-    void XtWX_xval_int(std::vector<MatrixXd > &xtx_list_, 
-                       std::vector<VectorXd > &xty_list_,
-                       std::vector<int > &nobs_list_, 
-                       std::vector<VectorXd > &colsq_list_) const {
-        
-        //MatrixRXd A = X;
         
-        
-        // static enforces k = i comes before k = i + 1
-        #pragma omp parallel for schedule(static)
-        for (int k = 1; k < nfolds + 1; ++k)
+        for (int k = 0; k < nfolds; ++k)
         {
-            
-            VectorXi idxbool = (foldid.array() == k).cast<int>();
-            int nrow_cur = idxbool.size();
-            int numelem = idxbool.sum();
-            VectorXi idx(numelem);
-            int c = 0;
-            for (int i = 0; i < nrow_cur; ++i)
+            // store the X'X and X'Y of the subset
+            // of data for fold k
+            if (add_int_)
             {
-                if (idxbool(i) == 1)
-                {
-                    idx(c) = i;
-                    ++c;
-                }
-            }
-            
-            // store subset of matrix X and response Y for this fold
-            MatrixXd sub(numelem, nvars);
-            VectorXd sub_y(numelem);
-            VectorXd sub_weights(numelem);
-            for (int r = 0; r < numelem; ++r)
+                xtx_list_[k].resize(nvars + 1, nvars + 1);
+                xtx_list_[k].bottomRightCorner(nvars, nvars) = gram_list[k];
+                xtx_list_[k].block(0,1,1,nvars) = colsums_k.col(k).transpose();
+                xtx_list_[k].block(1,0,nvars,1) = colsums_k.col(k);
+                xtx_list_[k](0,0) = wsum_k(k);
+                
+                xty_list_[k].resize(nvars + 1);
+                xty_list_[k].tail(nvars) = xty_k.col(k);
+                xty_list_[k](0) = ysum_k(k);
+            } else 
             {
-                int idx_tmp_val = idx(r);
-                sub.row(r)      = X.row(idx_tmp_val);
-                sub_y(r)        = Y(idx_tmp_val);
-                sub_weights(r)  = weights(idx_tmp_val);
+                xtx_list_[k].swap(gram_list[k]);
+                xty_list_[k] = xty_k.col(k);
             }
-            
-            MatrixXd AtAtmp(MatrixXd(nvars+1, nvars+1).setZero());
-            
-            // compute X'X for this fold 
-            // with intercept and weights
-            AtAtmp.bottomRightCorner(nvars, nvars) = MatrixXd(nvars, nvars).setZero()
-                  .selfadjointView<Lower>().rankUpdate((sub_weights.array().sqrt().matrix()).asDiagonal() * sub.adjoint() );
-            
-            Eigen::RowVectorXd colsums = (((sub_weights.array().matrix()).asDiagonal() * sub).colwise().sum()).matrix(); 
-            
-            AtAtmp.block(0,1,1,nvars) = colsums;
-            AtAtmp.block(1,0,nvars,1) = colsums.transpose();
-            AtAtmp(0,0) = sub_weights.sum();
-            
-            
-            // compute X'Y for this fold 
-            // with intercept 
-            VectorXd AtBtmp(nvars + 1);
-            VectorXd yw(numelem);
-            yw = (sub_y.array() * sub_weights.array());
-            AtBtmp.tail(nvars) = sub.adjoint() * yw;
-            AtBtmp(0) = yw.sum();
-            
-            //VectorXd colsqtmp = ((sub_weights.array().sqrt().matrix()).asDiagonal() * sub).array().square().colwise().sum();
-            VectorXd colsqtmp = sub.array().square().colwise().sum();
-            
-            sub.resize(0,0);
-            
-            // store the X'X and X'Y of the subset
-            // of data for fold k
-            xtx_list_[k-1]   = AtAtmp;
-            xty_list_[k-1]   = AtBtmp;
-            nobs_list_[k-1]  = numelem;
-            colsq_list_[k-1] = colsqtmp;
-            
+            nobs_list_[k]  = nobs_k(k);
+            colsq_list_[k] = colsq_k.col(k);
         }
     }
     
@@ -634,21 +195,7 @@ protected:
         if (penalty.find(grptxt) != std::string::npos)
         {
             found_grp_idx = true;
-            grp_idx.reserve(ngroups);
-            for (int g = 0; g < ngroups; ++g) 
-            {
-                // find all variables in group number g
-                std::vector<int> idx_tmp;
-                for (int v = 0; v < nvars + intercept; ++v) 
-                {
-                    if (groups(v) == unique_groups(g)) 
-                    {
-                        idx_tmp.push_back(v);
-                    }
-                }
-                grp_idx[g] = idx_tmp;
-                
-            }
+            grp_idx.build(groups, unique_groups, nvars + intercept);
             // if group weights were not specified,
             // then set the group weight for each
             // group to be the sqrt of the size of the
@@ -658,193 +205,118 @@ protected:
                 group_weights.resize(ngroups);
                 for (int g = 0; g < ngroups; ++g) 
                 {
-                    group_weights(g) = std::sqrt(double(grp_idx[g].size()));
+                    group_weights(g) = std::sqrt(double(grp_idx.size(g)));
                 }
             }
         }
     }
     
-    void compute_XtX_d_update_A(bool add_int_)
+    // turns the sums in XX, XY and colsq into
+    // X'X / n and X'Y / n for the current data,
+    // with the columns of X scaled to unit 
+    // variance if standardize is true. the
+    // scaling is applied to each element in 
+    // one pass instead of by diagonal products
+    void scale_xx_xy()
     {
-        // clear out XX, XY
-        XX.setZero();
-        XY.setZero();
-        
-        // compute X'X
-        // if weights specified, compute X'WX instead
-        // also need to handle differently
-        // if intercept == true
-        if (add_int_)
-        {
-            
-            if (wt_len)
-            {
-                
-                if (nobs > nvars) 
-                {
-                    // this computes all the X'X and X'Y
-                    // pieces for each fold
-                    XtWX_xval_int(xtx_list, xty_list, nobs_list, colsq_list);
-                } else 
-                {
-                    throw std::invalid_argument("dimension of x larger than number of observations");
-                }
-            } else 
-            {
-                if (nobs > nvars) 
-                {
-                    // this computes all the X'X and X'Y
-                    // pieces for each fold
-                    XtX_xval_int(xtx_list, xty_list, nobs_list, colsq_list);
-                } else 
-                {
-                    throw std::invalid_argument("dimension of x larger than number of observations");
-                }
-            }
-        } else 
-        {
-            if (wt_len)
-            {
-                if (nobs > nvars) 
-                {
-                    // this computes all the X'X and X'Y
-                    // pieces for each fold
-                    XtWX_xval(xtx_list, xty_list, nobs_list, colsq_list);
-                } else 
-                {
-                    throw std::invalid_argument("dimension of x larger than number of observations");
-                }
-            } else 
-            {
-                if (nobs > nvars) 
-                {
-                    // this computes all the X'X and X'Y
-                    // pieces for each fold
-                    XtX_xval(xtx_list, xty_list, nobs_list, colsq_list);
-                } else 
-                {
-                    throw std::invalid_argument("dimension of x larger than number of observations");
-                }
-            }
-        }
+        colsq /= (double(nobs) - 1.0);
+        colsq_inv = 1.0 / colsq.array().sqrt();
         
-        nobs = 0;
-        colsq.setZero();
-        for (int k = 0; k < nfolds; ++k)
+        // scaling of each row and column of XX
+        VectorXd scl(XXdim);
+        scl.fill(1.0);
+        if (standardize)
         {
-            // compute
-            // X'X and X'Y for all the data
-            // except current fold
-            XX += xtx_list[k];
-            XY += xty_list[k];
-            nobs += nobs_list[k];
-            colsq.array() += colsq_list[k].array();
+            scl.tail(nvars) = colsq_inv;
         }
         
-        colsq /= (nobs - 1);
-        colsq_inv = 1 / colsq.array().sqrt();
-        
-        
-        if (standardize)
+        const double nobs_inv = 1.0 / double(nobs);
+        for (int j = 0; j < XXdim; ++j)
         {
-            if (intercept)
+            const double sj = scl(j) * nobs_inv;
+            for (int i = 0; i < XXdim; ++i)
             {
-                XX.bottomRightCorner(nvars, nvars) = colsq_inv.asDiagonal() * XX.bottomRightCorner(nvars, nvars) * colsq_inv.asDiagonal();
-                XX.row(0).tail(nvars).array() *= colsq_inv.array();
-                XX.col(0).tail(nvars).array() *= colsq_inv.array();
-                //XX.topRightCorner(1, nvars).array()   *= colsq_inv.array();
-                //XX.bottomLeftCorner(nvars, 1).array() *= colsq_inv.array();
-                XY.tail(nvars).array() *= colsq_inv.array();
-            } else 
-            {
-                XX = colsq_inv.asDiagonal() * XX * colsq_inv.asDiagonal();
-                XY.array() *= colsq_inv.array();
+                XX(i, j) *= scl(i) * sj;
             }
         }
-        
-        XX /= nobs;
-        XY /= nobs;
-        
-        
-        Spectra::DenseSymMatProd<double> op(XX);
-        int ncv = 4;
-        if (XX.cols() < 4)
-        {
-            ncv = XX.cols();
-        }
-        
-        Spectra::SymEigsSolver< double, Spectra::LARGEST_ALGE, Spectra::DenseSymMatProd<double> > eigs(&op, 1, ncv);
-        
-        eigs.init();
-        eigs.compute(10000, 1e-10);
-        Vector eigenvals = eigs.eigenvalues();
-        d = eigenvals[0] * 1.005; // multiply by an increasing factor to be safe
-        
-        if (nobs > nvars)
-        {
-            A = -XX;
-            A.diagonal().array() += d;
-        }
+        XY.array() *= scl.array() * nobs_inv;
     }
     
-    void update_XtX_d_update_A(int fold_cur_)
+    void compute_XtX_d_update_A(bool add_int_)
     {
-        
+        // clear out XX, XY
         XX.setZero();
         XY.setZero();
-        nobs = 0;
         
-        colsq.setZero();
+        if (nobs <= nvars) 
+        {
+            throw std::invalid_argument("dimension of x larger than number of observations");
+        }
         
-        for (int k = 1; k < nfolds + 1; ++k)
+        // this computes all the X'X and X'Y
+        // pieces for each fold. if weights are
+        // specified, X'WX and X'WY instead
+        XtX_xval(xtx_list, xty_list, nobs_list, colsq_list, add_int_);
+        
+        // X'X and X'Y for all the data. the
+        // training pieces of each fold are 
+        // taken from these in update_XtX_d_update_A
+        xtx_total.setZero(XXdim, XXdim);
+        xty_total.setZero(XY.size());
+        colsq_total.setZero(nvars);
+        nobs_total = 0;
+        for (int k = 0; k < nfolds; ++k)
         {
-            // compute
-            // X'X and X'Y for all the data
-            // except current fold
-            if (k != fold_cur_)
-            {
-                XX += xtx_list[k-1];
-                XY += xty_list[k-1];
-                nobs += nobs_list[k-1];
-                colsq.array() += colsq_list[k-1].array();
-            }
+            xtx_total += xtx_list[k];
+            xty_total += xty_list[k];
+            nobs_total += nobs_list[k];
+            colsq_total += colsq_list[k];
         }
         
-        colsq /= (double(nobs) - 1.0);
-        colsq_inv = 1.0 / colsq.array().sqrt();
+        XX    = xtx_total;
+        XY    = xty_total;
+        nobs  = nobs_total;
+        colsq = colsq_total;
         
+        scale_xx_xy();
+        colsq_inv_total = colsq_inv;
         
+        // multiply by an increasing factor to be safe
+        d = max_eigenvalue_warm(XX, 1.005, std::numeric_limits<double>::infinity());
+        eig_total = eig_val;
+    }
+    
+    void update_XtX_d_update_A(int fold_cur_)
+    {
+        // X'X and X'Y for all the data
+        // except current fold
+        XX    = pieces->xtx_total   - pieces->xtx_list[fold_cur_ - 1];
+        XY    = pieces->xty_total   - pieces->xty_list[fold_cur_ - 1];
+        nobs  = pieces->nobs_total  - pieces->nobs_list[fold_cur_ - 1];
+        colsq = pieces->colsq_total - pieces->colsq_list[fold_cur_ - 1];
+        
+        scale_xx_xy();
+        
+        // the fold's X'X is the total minus a positive semidefinite
+        // piece, so once its columns are put on the scale of the 
+        // total it is at most nobs_total / nobs times the total's
+        // X'X in the Loewner order, which bounds its eigenvalues
+        double rescale = 1.0;
         if (standardize)
         {
+            rescale = (colsq_inv.array() / pieces->colsq_inv_total.array()).square().maxCoeff();
             if (intercept)
             {
-                XX.bottomRightCorner(nvars, nvars) = colsq_inv.asDiagonal() * XX.bottomRightCorner(nvars, nvars) * colsq_inv.asDiagonal();
-                XX.row(0).tail(nvars).array() *= colsq_inv.array();
-                XX.col(0).tail(nvars).array() *= colsq_inv.array();
-                XY.tail(nvars).array() *= colsq_inv.array();
-            } else 
-            {
-                XX = colsq_inv.asDiagonal() * XX * colsq_inv.asDiagonal();
-                XY.array() *= colsq_inv.array();
+                rescale = std::max(rescale, 1.0);
             }
         }
+        const double bound = pieces->eig_total * rescale * double(pieces->nobs_total) / double(nobs);
         
-        XX /= nobs;
-        XY /= nobs;
-        
-        Spectra::DenseSymMatProd<double> op(XX);
-        Spectra::SymEigsSolver< double, Spectra::LARGEST_ALGE, Spectra::DenseSymMatProd<double> > eigs(&op, 1, 4);
+        // warm started from the leading eigenvector of
+        // the previous fold or of the full data
+        d = max_eigenvalue_warm(XX, 1.005, bound);
         
-        eigs.init();
-        eigs.compute(10000, 1e-10);
-        Vector eigenvals = eigs.eigenvalues();
-        d = eigenvals[0] * 1.005; // multiply by an increasing factor to be safe
-        
-        if (nobs > nvars)
-        {
-            A = -XX;
-            A.diagonal().array() += d;
-        } else 
+        if (nobs <= nvars)
         {
             throw std::invalid_argument("dimension of x larger than number of observations");
         }
@@ -856,7 +328,7 @@ protected:
     {
         if (nobs > nvars)
         {
-            res.noalias() = A * beta_prev + XY;
+            sparse_A_prod(res, XX, beta_prev, XY);
         } else 
         {
             throw std::invalid_argument("dimension of x larger than number of observations");
@@ -864,116 +336,16 @@ protected:
         }
     }
     
-    
-    // define the beta update in oem
-    void next_beta(Vector &res)
+    bool next_u_delta(Vector &res, const Vector &delta)
     {
-        if (penalty == "lasso")
-        {
-            soft_threshold(beta, u, lambda, penalty_factor, d);
-        } else if (penalty == "ols")
-        {
-            beta = u / d;
-        } else if (penalty == "elastic.net")
-        {
-            double denom = d + (1.0 - alpha) * lambda;
-            double lam = lambda * alpha;
-            
-            soft_threshold(beta, u, lam, penalty_factor, denom);
-        } else if (penalty == "scad") 
-        {
-            soft_threshold_scad(beta, u, lambda, penalty_factor, d, gamma);
-            
-        } else if (penalty == "scad.net") 
-        {
-            double denom = d + (1.0 - alpha) * lambda;
-            double lam = lambda * alpha;
-            
-            if (alpha == 0)
-            {
-                lam   = 0;
-                denom = d + lambda;
-            }
-            
-            soft_threshold_scad(beta, u, lam, penalty_factor, denom, gamma);
-            
-        } else if (penalty == "mcp") 
-        {
-            soft_threshold_mcp(beta, u, lambda, penalty_factor, d, gamma);
-        } else if (penalty == "mcp.net") 
-        {
-            double denom = d + (1.0 - alpha) * lambda;
-            double lam = lambda * alpha;
-            
-            soft_threshold_mcp(beta, u, lam, penalty_factor, denom, gamma);
-            
-        } else if (penalty == "grp.lasso")
-        {
-            block_soft_threshold(beta, u, lambda, group_weights,
-                                 d, grp_idx, ngroups, 
-                                 unique_groups, groups);
-        } else if (penalty == "grp.lasso.net")
-        {
-            double denom = d + (1.0 - alpha) * lambda;
-            double lam = lambda * alpha;
-            
-            block_soft_threshold(beta, u, lam, group_weights,
-                                 denom, grp_idx, ngroups, 
-                                 unique_groups, groups);
-            
-        } else if (penalty == "grp.mcp")
-        {
-            block_soft_threshold_mcp(beta, u, lambda, group_weights,
-                                     d, grp_idx, ngroups, 
-                                     unique_groups, groups, gamma);
-        } else if (penalty == "grp.scad")
-        {
-            block_soft_threshold_scad(beta, u, lambda, group_weights,
-                                      d, grp_idx, ngroups, 
-                                      unique_groups, groups, gamma);
-        } else if (penalty == "grp.mcp.net")
-        {
-            double denom = d + (1.0 - alpha) * lambda;
-            double lam = lambda * alpha;
-            
-            
-            block_soft_threshold_mcp(beta, u, lam, group_weights,
-                                     denom, grp_idx, ngroups, 
-                                     unique_groups, groups, gamma);
-        } else if (penalty == "grp.scad.net")
-        {
-            double denom = d + (1.0 - alpha) * lambda;
-            double lam = lambda * alpha;
-            
-            block_soft_threshold_scad(beta, u, lam, group_weights,
-                                      denom, grp_idx, ngroups, 
-                                      unique_groups, groups, gamma);
-        } else if (penalty == "sparse.grp.lasso")
-        {
-            double lam_grp = (1.0 - tau) * lambda;
-            double lam_l1  = tau * lambda;
-            
-            double fact = 1.0;
-            
-            // first apply soft thresholding
-            // but don't divide by d
-            soft_threshold(beta, u, lam_l1, penalty_factor, fact);
-            
-            VectorXd beta_tmp = beta;
-            
-            // then apply block soft thresholding
-            block_soft_threshold(beta, beta_tmp, lam_grp, 
-                                 group_weights,
-                                 d, grp_idx, ngroups, 
-                                 unique_groups, groups);
-        }
-        
-        
+        add_sparse_A_prod(res, XX, delta);
+        return true;
     }
     
     
+    // define the beta update in oem
 public:
-    oemXvalDense(const Eigen::Ref<const MatrixRXd> &X_, 
+    oemXvalDense(const Eigen::Ref<const MatrixXd> &X_, 
                  ConstGenericVector &Y_,
                  const VectorXd &weights_,
                  const int &nfolds_,
@@ -987,7 +359,10 @@ public:
                  const double tol_ = 1e-6) :
     oemBase<Eigen::VectorXd>(X_.rows(), 
                              X_.cols(),
-                             unique_groups_.size(),
+                             groups_,
+                             unique_groups_,
+                             group_weights_,
+                             penalty_factor_,
                              intercept_, 
                              standardize_,
                              tol_),
@@ -995,23 +370,18 @@ public:
                              Y(Y_.data(), Y_.size()),
                              weights(weights_),
                              foldid(foldid_),
-                             groups(groups_),
-                             unique_groups(unique_groups_),
-                             penalty_factor(penalty_factor_),
-                             group_weights(group_weights_),
                              penalty_factor_size(penalty_factor_.size()),
                              XXdim( std::min(X_.cols(), X_.rows()) + intercept_ * (X_.rows() > X_.cols()) ),
                              XY(X_.cols() + intercept_),      // add extra space if intercept 
                              XX(XXdim, XXdim),                // add extra space if intercept 
-                             default_group_weights(bool(group_weights_.size() < 1)), // compute default weights if none given
                              nfolds(nfolds_),
                              xtx_list(nfolds_),
                              xty_list(nfolds_),
                              nobs_list(nfolds_),
                              colsq_list(nfolds_),
+                             pieces(this),
                              colsq_inv(X_.cols()),
-                             colsq(X_.cols()),
-                             grp_idx(unique_groups_.size())
+                             colsq(X_.cols())
     
     {}
     
@@ -1040,6 +410,30 @@ public:
         update_XtX_d_update_A(fold_);
     }
     
+    // sets this solver up to fit the training data of
+    // fold fold_ from the fold pieces of X'X and X'Y
+    // computed by init_xtx() of src. the pieces are
+    // shared, not copied, so src must outlive this
+    // solver. only reads src, so solvers for different
+    // folds can be set up and fit at the same time
+    void share_xtx(const oemXvalDense &src, int fold_)
+    {
+        wt_len = weights.size();
+        
+        found_grp_idx = false;
+        
+        pieces = &src;
+        eig_vec = src.eig_vec;
+        update_XtX_d_update_A(fold_);
+        
+        if (intercept)
+        {
+            u.resize(nvars + 1);
+            beta.resize(nvars + 1);
+            beta_prev.resize(nvars + 1);
+        }
+    }
+    
     double compute_lambda_zero() 
     { 
         
@@ -1067,7 +461,6 @@ public:
         }
         return lambda0; 
     }
-    double get_d() { return d; }
     
     // init() is a cold start for the first lambda
     void init(double lambda_, std::string penalty_,
@@ -1076,7 +469,7 @@ public:
         beta.setZero();
         
         lambda = lambda_;
-        penalty = penalty_;
+        set_penalty(penalty_);
         
         alpha = alpha_;
         gamma = gamma_;
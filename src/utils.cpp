@@ -2,6 +2,20 @@
 
 #include "utils.h"
 
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+int resolve_ncores(int ncores)
+{
+#ifdef _OPENMP
+  const int nthreads = omp_get_max_threads();
+#else
+  const int nthreads = 1;
+#endif
+  return (ncores < 1) ? std::max(nthreads - 1, 1) : ncores;
+}
+
 double threshold(double num) 
 {
   return num > 0 ? num : 0;
@@ -15,6 +15,7 @@ using namespace Rcpp;
 using namespace RcppEigen;
 
 using Eigen::MatrixXd;
+using Eigen::MatrixXf;
 using Eigen::ArrayXd;
 using Eigen::VectorXd;
 using Eigen::VectorXi;
@@ -143,6 +144,10 @@ void block_soft_threshold(SpVec &res, const VectorXd &vec, const double &penalty
                                  const int &ngroups, const MapVeci &unique_grps, const MapVeci &grps);
  */ 
   
+// the number of threads to fit with, where 
+// ncores < 1 takes all threads but one
+int resolve_ncores(int ncores);
+
 bool stopRule(const VectorXd& cur, const VectorXd& prev, const double& tolerance);
 
 bool stopRule(const SpVec& cur, const SpVec& prev, const double& tolerance);